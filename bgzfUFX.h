@@ -0,0 +1,291 @@
+#ifndef BGZF_UFX_H
+#define BGZF_UFX_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <zlib.h>
+#ifdef __UPC__
+#include <upc.h>
+#endif
+
+/* Reading of block-compressed UFX files in the BGZF format (as written by "bgzip -i").
+   BGZF is a series of independent gzip members of at most 64KB of uncompressed data, so any
+   byte range of the uncompressed UFX can be read by inflating only the blocks that cover it.
+   Since every UFX line is LINE_SIZE bytes, the k-mers [first, last) of a thread are the bytes
+   [first*LINE_SIZE, last*LINE_SIZE) and the per-thread partitioning stays the same as for
+   uncompressed input. The block index comes from the <file>.gzi written by "bgzip -i" when it
+   exists, otherwise it is rebuilt by walking the block headers */
+
+#define BGZF_HEADER_SIZE 18
+#define BGZF_MAX_BLOCK_SIZE 65536
+
+/* BGZF block index data structure */
+typedef struct bgzf_index_t bgzf_index_t;
+struct bgzf_index_t {
+  int64_t nBlocks;
+  int64_t *compressedOffset;     // nBlocks+1 entries: start of each block in the file, then the file size
+  int64_t *uncompressedOffset;   // nBlocks+1 entries: first uncompressed byte of each block, then the total
+};
+
+/* Returns the little-endian 16 and 32 bit values at p */
+static uint32_t bgzfLoad16(const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t bgzfLoad32(const unsigned char *p) {
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t) p[3] << 24);
+}
+
+/* Returns the total size of the BGZF block whose header is in header, or -1 if it is not a BGZF header */
+static int64_t bgzfBlockSize(const unsigned char *header) {
+  if (header[0] != 31 || header[1] != 139 || header[2] != 8 || !(header[3] & 4)) {
+    return -1;
+  }
+  /* The BC subfield holds the total block size minus one */
+  if (bgzfLoad16(header + 10) != 6 || header[12] != 'B' || header[13] != 'C' || bgzfLoad16(header + 14) != 2) {
+    return -1;
+  }
+  return bgzfLoad16(header + 16) + 1;
+}
+
+/* Returns 1 if filename starts with a BGZF block */
+int isBgzfFile(const char *filename) {
+  unsigned char header[BGZF_HEADER_SIZE];
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    return 0;
+  }
+  int isBgzf = fread(header, 1, BGZF_HEADER_SIZE, f) == BGZF_HEADER_SIZE && bgzfBlockSize(header) > 0;
+  fclose(f);
+  return isBgzf;
+}
+
+/* Appends a block starting at (compressedOffset, uncompressedOffset) to the index */
+static int appendBgzfBlock(bgzf_index_t *index, int64_t *capacity, int64_t compressedOffset, int64_t uncompressedOffset) {
+  if (index->nBlocks + 1 >= *capacity) {
+    *capacity *= 2;
+    index->compressedOffset = (int64_t*) realloc(index->compressedOffset, *capacity * sizeof(int64_t));
+    index->uncompressedOffset = (int64_t*) realloc(index->uncompressedOffset, *capacity * sizeof(int64_t));
+    if (index->compressedOffset == NULL || index->uncompressedOffset == NULL) {
+      return -1;
+    }
+  }
+  index->compressedOffset[index->nBlocks] = compressedOffset;
+  index->uncompressedOffset[index->nBlocks] = uncompressedOffset;
+  index->nBlocks++;
+  return 0;
+}
+
+/* Builds the block index of a BGZF file. Returns 0 on success and a negative value on failure */
+int loadBgzfIndex(const char *filename, bgzf_index_t *index) {
+  int64_t capacity = 1024, compressedOffset = 0, uncompressedOffset = 0;
+  unsigned char header[BGZF_HEADER_SIZE], footer[4];
+  char gziName[4096];
+
+  index->nBlocks = 0;
+  index->compressedOffset = (int64_t*) malloc(capacity * sizeof(int64_t));
+  index->uncompressedOffset = (int64_t*) malloc(capacity * sizeof(int64_t));
+  if (index->compressedOffset == NULL || index->uncompressedOffset == NULL) {
+    fprintf(stderr, "Could not allocate memory for the BGZF index of %s\n", filename);
+    return -1;
+  }
+
+  /* The .gzi lists (compressed, uncompressed) offsets of every block but the first one */
+  snprintf(gziName, sizeof(gziName), "%s.gzi", filename);
+  FILE *gzi = fopen(gziName, "r");
+  if (gzi != NULL) {
+    unsigned char entry[16];
+    uint64_t nEntries = 0;
+    if (fread(entry, 1, 8, gzi) == 8) {
+      nEntries = bgzfLoad32(entry) | ((uint64_t) bgzfLoad32(entry + 4) << 32);
+    }
+    for (uint64_t i = 0; i < nEntries && fread(entry, 1, 16, gzi) == 16; i++) {
+      if (appendBgzfBlock(index, &capacity, compressedOffset, uncompressedOffset) != 0) {
+        fclose(gzi);
+        return -1;
+      }
+      compressedOffset = bgzfLoad32(entry) | ((uint64_t) bgzfLoad32(entry + 4) << 32);
+      uncompressedOffset = bgzfLoad32(entry + 8) | ((uint64_t) bgzfLoad32(entry + 12) << 32);
+    }
+    fclose(gzi);
+  }
+
+  /* Walk the remaining block headers (all of them if there is no .gzi) */
+  FILE *f = fopen(filename, "r");
+  if (f == NULL) {
+    fprintf(stderr, "Could not open %s for reading!\n", filename);
+    return -2;
+  }
+  while (fseeko(f, compressedOffset, SEEK_SET) == 0 && fread(header, 1, BGZF_HEADER_SIZE, f) == BGZF_HEADER_SIZE) {
+    int64_t blockSize = bgzfBlockSize(header);
+    if (blockSize < 0 || fseeko(f, compressedOffset + blockSize - 4, SEEK_SET) != 0 || fread(footer, 1, 4, f) != 4) {
+      fprintf(stderr, "Corrupted BGZF block at offset %lld of %s\n", (long long) compressedOffset, filename);
+      fclose(f);
+      return -3;
+    }
+    if (appendBgzfBlock(index, &capacity, compressedOffset, uncompressedOffset) != 0) {
+      fclose(f);
+      return -1;
+    }
+    compressedOffset += blockSize;
+    uncompressedOffset += bgzfLoad32(footer);
+  }
+  fclose(f);
+
+  index->compressedOffset[index->nBlocks] = compressedOffset;
+  index->uncompressedOffset[index->nBlocks] = uncompressedOffset;
+  return 0;
+}
+
+/* Inflates length bytes of the uncompressed data starting at offset into buffer, touching only
+   the blocks that cover that range. Returns the number of bytes read */
+int64_t readBgzfRange(const char *filename, bgzf_index_t *index, int64_t offset, int64_t length, unsigned char *buffer) {
+  unsigned char *compressed = (unsigned char*) malloc(BGZF_MAX_BLOCK_SIZE);
+  unsigned char *uncompressed = (unsigned char*) malloc(BGZF_MAX_BLOCK_SIZE);
+  int64_t charsRead = 0;
+  z_stream strm;
+
+  FILE *f = fopen(filename, "r");
+  memset(&strm, 0, sizeof(z_stream));
+  if (f == NULL || compressed == NULL || uncompressed == NULL || inflateInit2(&strm, -15) != Z_OK) {
+    fprintf(stderr, "Could not set up reading of %s\n", filename);
+    free(compressed);
+    free(uncompressed);
+    if (f != NULL) {
+      fclose(f);
+    }
+    return 0;
+  }
+
+  /* Binary search for the block holding the first byte */
+  int64_t lo = 0, hi = index->nBlocks;
+  while (hi - lo > 1) {
+    int64_t mid = (lo + hi) / 2;
+    if (index->uncompressedOffset[mid] <= offset) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (int64_t b = lo; b < index->nBlocks && charsRead < length; b++) {
+    int64_t blockSize = index->compressedOffset[b+1] - index->compressedOffset[b];
+    int64_t blockChars = index->uncompressedOffset[b+1] - index->uncompressedOffset[b];
+    if (blockChars == 0) {
+      continue;
+    }
+    if (fseeko(f, index->compressedOffset[b], SEEK_SET) != 0 || fread(compressed, 1, blockSize, f) != blockSize) {
+      break;
+    }
+
+    inflateReset(&strm);
+    strm.next_in = compressed + BGZF_HEADER_SIZE;
+    strm.avail_in = blockSize - BGZF_HEADER_SIZE - 8;
+    strm.next_out = uncompressed;
+    strm.avail_out = BGZF_MAX_BLOCK_SIZE;
+    if (inflate(&strm, Z_FINISH) != Z_STREAM_END || strm.total_out != blockChars) {
+      fprintf(stderr, "Could not inflate BGZF block at offset %lld of %s\n", (long long) index->compressedOffset[b], filename);
+      break;
+    }
+
+    /* Copy the part of the block that overlaps [offset, offset+length) */
+    int64_t from = offset + charsRead - index->uncompressedOffset[b];
+    int64_t count = blockChars - from;
+    if (count > length - charsRead) {
+      count = length - charsRead;
+    }
+    memcpy(buffer + charsRead, uncompressed + from, count);
+    charsRead += count;
+  }
+
+  inflateEnd(&strm);
+  fclose(f);
+  free(compressed);
+  free(uncompressed);
+  return charsRead;
+}
+
+/* Returns the number of UFX kmers in a BGZF file, and performs the same checks as getNumKmersInUFX */
+int64_t getNumKmersInBgzfUFX(const char *filename, bgzf_index_t *index) {
+  if (loadBgzfIndex(filename, index) != 0) {
+    return -1;
+  }
+  char firstLine[ LINE_SIZE+1 ];
+  firstLine[LINE_SIZE] = '\0';
+  if (readBgzfRange(filename, index, 0, LINE_SIZE, (unsigned char*) firstLine) != LINE_SIZE) {
+    fprintf(stderr, "Could not read %d bytes!\n", LINE_SIZE);
+    return -2;
+  }
+  if (firstLine[KMER_LENGTH] != ' ' && firstLine[KMER_LENGTH] != '\t') {
+    fprintf(stderr, "Unexpected format for firstLine '%s'\n", firstLine);
+    return -4;
+  }
+
+  int64_t totalSize = index->uncompressedOffset[index->nBlocks];
+  if (totalSize % LINE_SIZE != 0) {
+    fprintf(stderr, "UFX file is not a multiple of %d bytes for kmer length %d\n", LINE_SIZE, KMER_LENGTH);
+    return -6;
+  }
+  int64_t numKmers = totalSize / LINE_SIZE;
+  printf("Detected %lld kmers in %lld BGZF blocks of compressed UFX file: %s\n", (long long) numKmers, (long long) index->nBlocks, filename);
+  return numKmers;
+}
+
+#ifdef __UPC__
+/* Collective version of getNumKmersInBgzfUFX: only ROOT builds the block index, which is then
+   copied to every thread, so the file is walked once instead of once per thread */
+int64_t getNumKmersInBgzfUFXAll(const char *filename, bgzf_index_t *index) {
+  shared [] int64_t *counts = upc_all_alloc(1, 2 * sizeof(int64_t));
+  if (counts == NULL) {
+    fprintf(stderr, "Could not allocate memory to share the BGZF index of %s\n", filename);
+    upc_global_exit(1);
+  }
+  if (MYTHREAD == ROOT) {
+    counts[0] = getNumKmersInBgzfUFX(filename, index);
+    counts[1] = (counts[0] >= 0) ? index->nBlocks : 0;
+  }
+  upc_barrier;
+
+  int64_t numKmers = counts[0];
+  int64_t nBlocks = counts[1];
+  shared [] int64_t *offsets = upc_all_alloc(1, 2 * (nBlocks + 1) * sizeof(int64_t));
+  if (offsets == NULL) {
+    fprintf(stderr, "Could not allocate memory to share the BGZF index of %s\n", filename);
+    upc_global_exit(1);
+  }
+  if (MYTHREAD == ROOT && numKmers >= 0) {
+    upc_memput(offsets, index->compressedOffset, (nBlocks + 1) * sizeof(int64_t));
+    upc_memput(&offsets[nBlocks + 1], index->uncompressedOffset, (nBlocks + 1) * sizeof(int64_t));
+  }
+  upc_barrier;
+
+  if (MYTHREAD != ROOT) {
+    index->nBlocks = nBlocks;
+    index->compressedOffset = (int64_t*) malloc((nBlocks + 1) * sizeof(int64_t));
+    index->uncompressedOffset = (int64_t*) malloc((nBlocks + 1) * sizeof(int64_t));
+    if (index->compressedOffset == NULL || index->uncompressedOffset == NULL) {
+      fprintf(stderr, "Could not allocate memory for the BGZF index of %s\n", filename);
+      upc_global_exit(1);
+    }
+    upc_memget(index->compressedOffset, offsets, (nBlocks + 1) * sizeof(int64_t));
+    upc_memget(index->uncompressedOffset, &offsets[nBlocks + 1], (nBlocks + 1) * sizeof(int64_t));
+  }
+
+  // Everybody must be done copying before the shared index is freed
+  upc_barrier;
+  upc_all_free(offsets);
+  upc_all_free(counts);
+  return numKmers;
+}
+#endif
+
+/* Deallocate the BGZF index */
+int deallocBgzfIndex(bgzf_index_t *index) {
+  free(index->compressedOffset);
+  free(index->uncompressedOffset);
+  return 0;
+}
+
+#endif // BGZF_UFX_H
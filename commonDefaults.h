@@ -25,26 +25,47 @@
 #define LINE_SIZE (KMER_LENGTH+4)
 #endif
 
+/* The heap grows in segments of 2^HEAP_SEGMENT_BITS k-mers */
+#ifndef HEAP_SEGMENT_BITS
+#define HEAP_SEGMENT_BITS 16
+#endif
+#define HEAP_SEGMENT_SIZE (((int64_t) 1) << HEAP_SEGMENT_BITS)
+
+/* Minimum number of buckets, used when the number of k-mers is not known up front */
+#ifndef MIN_TABLE_SIZE
+#define MIN_TABLE_SIZE 1024
+#endif
+
+/* Number of old buckets moved to the new table by every insert while the table grows */
+#ifndef REHASH_STEP
+#define REHASH_STEP 4
+#endif
+
+/* Number of UFX lines read at a time from a stream */
+#ifndef STREAM_CHUNK_LINES
+#define STREAM_CHUNK_LINES 65536
+#endif
+
 /* K-mer data structure */
 typedef struct kmer_t kmer_t;
 struct kmer_t{
   char kmer[KMER_PACKED_LENGTH];
   char l_ext;
   char r_ext;
-  kmer_t *next;
+  int64_t next;          // Index to kmer_t in heap (-1 ends the chain)
 };
 
 /* Start k-mer data structure */
 typedef struct start_kmer_t start_kmer_t;
 struct start_kmer_t{
-  kmer_t *kmerPtr;
+  int64_t kmerIndex;     // Index to kmer_t in heap
   start_kmer_t *next;
 };
 
 /* Bucket data structure */
 typedef struct bucket_t bucket_t;
 struct bucket_t{
-  kmer_t *head;          // Pointer to the first entry of that bucket
+  int64_t head;          // Heap index to the first entry of that bucket (-1 if empty)
 };
 
 /* Hash table data structure */
@@ -52,12 +73,17 @@ typedef struct hash_table_t hash_table_t;
 struct hash_table_t {
   int64_t size;          // Size of the hash table
   bucket_t *table;	 // Entries of the hash table are pointers to buckets
+  int64_t nEntries;      // Number of k-mers in the hash table
+  int64_t oldSize;       // Size of the table being rehashed into table, 0 if none
+  bucket_t *oldTable;    // Buckets of oldTable below rehashPos have already been moved
+  int64_t rehashPos;
 };
 
 /* Memory heap data structure */
 typedef struct memory_heap_t memory_heap_t;
 struct memory_heap_t {
-  kmer_t *heap;
+  kmer_t **segments;     // Entry i of the heap is segments[i >> HEAP_SEGMENT_BITS][i & (HEAP_SEGMENT_SIZE-1)]
+  int64_t nSegments;
   int64_t posInHeap;
 };
 
@@ -110,6 +136,15 @@ int64_t getNumKmersInUFX(const char *filename) {
   return numKmers;
 }
 
+/* Returns 1 if the input is a stream whose number of kmers cannot be known up front ("-" for stdin, or a pipe) */
+int isUFXStream(const char *filename) {
+  struct stat buf;
+  if (strcmp(filename, "-") == 0) {
+    return 1;
+  }
+  return stat(filename, &buf) == 0 && !S_ISREG(buf.st_mode);
+}
+
 /** Utility function to get the current time */
 static double gettime(void) {
   struct timeval tv;
@@ -30,6 +30,11 @@
 #define ROOT 0
 #endif
 
+/* Placement of k-mers on threads: by the hash of the whole k-mer, or by the minimizer of the
+   k-mer so that consecutive k-mers of a contig usually land on the same thread */
+#define PLACEMENT_HASH 0
+#define PLACEMENT_MINIMIZER 1
+
 /* K-mer data structure */
 typedef struct kmer_t kmer_t;
 struct kmer_t{
@@ -50,7 +55,9 @@ struct start_kmer_t{
 typedef struct memory_heap_t memory_heap_t;
 struct memory_heap_t {
   shared [1] kmer_t *heap;      // Cycled heap array
+  kmer_t **localHeaps;          // Private base of each thread's part of the heap, NULL if not castable
   int64_t posInHeap;            // Logical thread offset/phase
+  shared int64_t *heapFill;     // Used entries of each thread's part of the heap, only with PLACEMENT_MINIMIZER
 };
 
 /* Bucket data structure */
@@ -64,6 +71,8 @@ typedef struct hash_table_t hash_table_t;
 struct hash_table_t {
   int64_t size;                 // Size of the hash table
   shared bucket_t *table;	// Entries of the hash table buckets
+  bucket_t **localTables;       // Private base of each thread's buckets, NULL if not castable
+  int placement;                // PLACEMENT_HASH or PLACEMENT_MINIMIZER
 };
 
 
@@ -0,0 +1,312 @@
+#ifndef EXTERNAL_ASSEMBLY_H
+#define EXTERNAL_ASSEMBLY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "commonDefaults.h"
+#include "kmerHash.h"
+#include "bgzfUFX.h"
+#include "minimizer.h"
+
+/* External-memory assembly for graphs that do not fit in memory at once:
+   1. scatterUFX writes every UFX line to one of nPartitions files on disk, chosen by the
+      minimizer of its k-mer, so long runs of a contig land in the same partition.
+   2. assemblePartition builds the hash table of one partition at a time and walks every
+      segment: a maximal run of a contig that stays in the partition. Segments are spilled to
+      disk, with the base that leads into the next partition when the contig goes on.
+   3. stitchSegments indexes the segments that do not start a contig by their first k-mer and
+      follows the links from every contig-starting segment to write the contigs.
+   Only one partition graph and the segment index are in memory at any time */
+
+#define SEGMENT_LINE_SIZE (MAXIMUM_CONTIG_SIZE+8)
+
+/* Index entry of a segment that does not start a contig */
+typedef struct segment_ref_t segment_ref_t;
+struct segment_ref_t {
+  char kmer[KMER_PACKED_LENGTH];   // First k-mer of the segment
+  int32_t partition;
+  int64_t offset;                  // Offset of the segment line in its segment file
+  int64_t next;                    // Next entry of the same bucket (-1 ends the chain)
+};
+
+/* Returns the partition of an unpacked kmer */
+int kmerPartition(const unsigned char *kmer, int nPartitions) {
+  return minimizerHash(kmer) % nPartitions;
+}
+
+/* Writes the name of the file of a given kind for partition p into filename */
+void partitionFileName(char *filename, size_t size, const char *dir, const char *kind, int p) {
+  snprintf(filename, size, "%s/%s-%d.txt", dir, kind, p);
+}
+
+/* Scatters the UFX lines of the input (plain, BGZF or stream) into nPartitions files in dir.
+   Returns the number of k-mers scattered, or a negative value on failure */
+int64_t scatterUFX(const char *inputUFXName, const char *dir, int nPartitions) {
+  char filename[4096];
+  int64_t nKmers = 0, offset = 0, charsRead, totalChars = -1;
+  bgzf_index_t bgzfIndex;
+  FILE *inputFile = NULL;
+
+  int streamInput = isUFXStream(inputUFXName);
+  int compressedInput = !streamInput && isBgzfFile(inputUFXName);
+  if (compressedInput) {
+    totalChars = getNumKmersInBgzfUFX(inputUFXName, &bgzfIndex) * LINE_SIZE;
+    if (totalChars < 0) {
+      return -1;
+    }
+  } else {
+    if (!streamInput && getNumKmersInUFX(inputUFXName) < 0) {
+      return -1;
+    }
+    inputFile = (strcmp(inputUFXName, "-") == 0) ? stdin : fopen(inputUFXName, "r");
+    if (inputFile == NULL) {
+      fprintf(stderr, "Could not open %s for reading!\n", inputUFXName);
+      return -1;
+    }
+  }
+
+  FILE **partitionFiles = (FILE**) malloc(nPartitions * sizeof(FILE*));
+  unsigned char *buffer = (unsigned char*) malloc(STREAM_CHUNK_LINES * LINE_SIZE);
+  if (partitionFiles == NULL || buffer == NULL) {
+    fprintf(stderr, "ERROR: Could not allocate memory to scatter %s\n", inputUFXName);
+    return -2;
+  }
+  for (int p = 0; p < nPartitions; p++) {
+    partitionFileName(filename, sizeof(filename), dir, "partition", p);
+    partitionFiles[p] = fopen(filename, "w");
+    if (partitionFiles[p] == NULL) {
+      fprintf(stderr, "Could not open %s for writing!\n", filename);
+      return -3;
+    }
+  }
+
+  do {
+    if (compressedInput) {
+      int64_t length = totalChars - offset;
+      if (length > STREAM_CHUNK_LINES * LINE_SIZE) {
+        length = STREAM_CHUNK_LINES * LINE_SIZE;
+      }
+      charsRead = readBgzfRange(inputUFXName, &bgzfIndex, offset, length, buffer);
+      offset += charsRead;
+    } else {
+      charsRead = fread(buffer, sizeof(unsigned char), STREAM_CHUNK_LINES * LINE_SIZE, inputFile);
+    }
+    if (charsRead % LINE_SIZE != 0) {
+      fprintf(stderr, "UFX input %s is not made of %d byte lines for kmer length %d\n", inputUFXName, LINE_SIZE, KMER_LENGTH);
+      return -4;
+    }
+    for (int64_t ptr = 0; ptr < charsRead; ptr += LINE_SIZE) {
+      int p = kmerPartition(&buffer[ptr], nPartitions);
+      fwrite(&buffer[ptr], sizeof(unsigned char), LINE_SIZE, partitionFiles[p]);
+      nKmers++;
+    }
+  } while (charsRead > 0);
+
+  for (int p = 0; p < nPartitions; p++) {
+    if (fclose(partitionFiles[p]) != 0) {
+      fprintf(stderr, "Could not write partition %d to %s\n", p, dir);
+      return -5;
+    }
+  }
+  if (compressedInput) {
+    deallocBgzfIndex(&bgzfIndex);
+  } else if (inputFile != stdin) {
+    fclose(inputFile);
+  }
+  free(partitionFiles);
+  free(buffer);
+
+  printf("Scattered %lld kmers into %d partitions (%lld bytes) in %s\n", nKmers, nPartitions, nKmers * LINE_SIZE, dir);
+  return nKmers;
+}
+
+/* Builds the graph of partition p, writes its segments to the segment file of p and removes
+   the partition file. Each segment line is "<S|M><T|L> <bases>": S if it starts a contig, M
+   otherwise; T if it ends the contig, L if it links to the next partition, in which case the
+   last KMER_LENGTH bases are the first k-mer of the next segment. Returns the number of M
+   segments, or a negative value on failure */
+int64_t assemblePartition(const char *dir, int p, int nPartitions) {
+  char filename[4096], segment[MAXIMUM_CONTIG_SIZE+1], predecessor[KMER_LENGTH];
+  int64_t nMiddleSegments = 0;
+  memory_heap_t memory_heap;
+
+  partitionFileName(filename, sizeof(filename), dir, "partition", p);
+  FILE *partitionFile = fopen(filename, "r");
+  if (partitionFile == NULL) {
+    fprintf(stderr, "Could not open %s for reading!\n", filename);
+    return -1;
+  }
+  fseeko(partitionFile, 0, SEEK_END);
+  int64_t nKmers = ftello(partitionFile) / LINE_SIZE;
+  rewind(partitionFile);
+
+  /* Build the hash table of the partition */
+  hash_table_t *hashtable = createHashTable(nKmers, &memory_heap);
+  unsigned char *buffer = (unsigned char*) malloc(STREAM_CHUNK_LINES * LINE_SIZE);
+  int64_t charsRead;
+  while ((charsRead = fread(buffer, sizeof(unsigned char), STREAM_CHUNK_LINES * LINE_SIZE, partitionFile)) > 0) {
+    for (int64_t ptr = 0; ptr + LINE_SIZE <= charsRead; ptr += LINE_SIZE) {
+      addKmer(hashtable, &memory_heap, &buffer[ptr], (char) buffer[ptr+KMER_LENGTH+1], (char) buffer[ptr+KMER_LENGTH+2]);
+    }
+  }
+  fclose(partitionFile);
+  free(buffer);
+  unlink(filename);
+
+  partitionFileName(filename, sizeof(filename), dir, "segments", p);
+  FILE *segmentFile = fopen(filename, "w");
+  if (segmentFile == NULL) {
+    fprintf(stderr, "Could not open %s for writing!\n", filename);
+    return -2;
+  }
+
+  /* A segment starts at every k-mer whose predecessor is not in this partition */
+  for (int64_t i = 0; i < memory_heap.posInHeap; i++) {
+    kmer_t *cur_kmer_ptr = heapKmer(&memory_heap, i);
+    int startsContig = (cur_kmer_ptr->l_ext == 'F');
+    unpackSequence((unsigned char*) cur_kmer_ptr->kmer, (unsigned char*) segment, KMER_LENGTH);
+    if (!startsContig) {
+      predecessor[0] = cur_kmer_ptr->l_ext;
+      memcpy(&predecessor[1], segment, (KMER_LENGTH-1) * sizeof(char));
+      if (kmerPartition((unsigned char*) predecessor, nPartitions) == p) {
+        continue;
+      }
+    }
+
+    /* Walk until the contig ends or leaves the partition */
+    int64_t posInSegment = KMER_LENGTH;
+    int links = 0;
+    while (cur_kmer_ptr->r_ext != 'F') {
+      segment[posInSegment] = cur_kmer_ptr->r_ext;
+      posInSegment++;
+      const unsigned char *next = (const unsigned char*) &segment[posInSegment-KMER_LENGTH];
+      if (kmerPartition(next, nPartitions) != p) {
+        links = 1;
+        break;
+      }
+      cur_kmer_ptr = lookupKmer(hashtable, &memory_heap, next);
+    }
+    segment[posInSegment] = '\0';
+    fprintf(segmentFile, "%c%c %s\n", startsContig ? 'S' : 'M', links ? 'L' : 'T', segment);
+    if (!startsContig) {
+      nMiddleSegments++;
+    }
+  }
+
+  deallocHeap(&memory_heap);
+  deallocHashtable(hashtable);
+  free(hashtable);
+  if (fclose(segmentFile) != 0) {
+    fprintf(stderr, "Could not write %s\n", filename);
+    return -3;
+  }
+  return nMiddleSegments;
+}
+
+/* Follows the segment links from every contig-starting segment and writes the contigs to
+   outputFile, then removes the segment files. Returns the number of contigs, or a negative
+   value on failure */
+int64_t stitchSegments(const char *dir, int nPartitions, int64_t nMiddleSegments, FILE *outputFile, int64_t *totBases) {
+  char filename[4096], packedKmer[KMER_PACKED_LENGTH];
+  char *line = (char*) malloc(SEGMENT_LINE_SIZE);
+  char *contig = (char*) malloc(MAXIMUM_CONTIG_SIZE+1);
+  int64_t nBuckets = (nMiddleSegments > 0 ? nMiddleSegments : 1) * LOAD_FACTOR;
+  int64_t *buckets = (int64_t*) malloc(nBuckets * sizeof(int64_t));
+  segment_ref_t *refs = (segment_ref_t*) malloc((nMiddleSegments > 0 ? nMiddleSegments : 1) * sizeof(segment_ref_t));
+  FILE **segmentFiles = (FILE**) malloc(nPartitions * sizeof(FILE*));
+  int64_t nRefs = 0, nContigs = 0;
+
+  if (line == NULL || contig == NULL || buckets == NULL || refs == NULL || segmentFiles == NULL) {
+    fprintf(stderr, "ERROR: Could not allocate memory for the index of %lld segments\n", nMiddleSegments);
+    return -1;
+  }
+  memset(buckets, 0xff, nBuckets * sizeof(int64_t));
+
+  /* Index the segments that do not start a contig by their first k-mer */
+  for (int p = 0; p < nPartitions; p++) {
+    partitionFileName(filename, sizeof(filename), dir, "segments", p);
+    segmentFiles[p] = fopen(filename, "r");
+    if (segmentFiles[p] == NULL) {
+      fprintf(stderr, "Could not open %s for reading!\n", filename);
+      return -2;
+    }
+    int64_t offset = ftello(segmentFiles[p]);
+    while (fgets(line, SEGMENT_LINE_SIZE, segmentFiles[p]) != NULL) {
+      if (line[0] == 'M' && nRefs < nMiddleSegments) {
+        segment_ref_t *ref = &refs[nRefs];
+        packSequence((unsigned char*) &line[3], (unsigned char*) ref->kmer, KMER_LENGTH);
+        int64_t hashval = hashKmer(nBuckets, ref->kmer);
+        ref->partition = p;
+        ref->offset = offset;
+        ref->next = buckets[hashval];
+        buckets[hashval] = nRefs;
+        nRefs++;
+      }
+      offset = ftello(segmentFiles[p]);
+    }
+  }
+
+  /* Stitch every contig from its starting segment */
+  for (int p = 0; p < nPartitions; p++) {
+    partitionFileName(filename, sizeof(filename), dir, "segments", p);
+    FILE *startFile = fopen(filename, "r");
+    if (startFile == NULL) {
+      fprintf(stderr, "Could not open %s for reading!\n", filename);
+      return -2;
+    }
+    while (fgets(line, SEGMENT_LINE_SIZE, startFile) != NULL) {
+      if (line[0] != 'S') {
+        continue;
+      }
+      int64_t posInContig = strcspn(&line[3], "\n");
+      memcpy(contig, &line[3], posInContig * sizeof(char));
+      int links = (line[1] == 'L');
+
+      while (links) {
+        /* The last KMER_LENGTH bases are the first k-mer of the next segment */
+        packSequence((unsigned char*) &contig[posInContig-KMER_LENGTH], (unsigned char*) packedKmer, KMER_LENGTH);
+        int64_t cur = buckets[hashKmer(nBuckets, packedKmer)];
+        while (cur != -1 && memcmp(packedKmer, refs[cur].kmer, KMER_PACKED_LENGTH * sizeof(char)) != 0) {
+          cur = refs[cur].next;
+        }
+        if (cur == -1) {
+          fprintf(stderr, "ERROR: No segment starts with the k-mer linked from partition %d!\n", p);
+          return -3;
+        }
+        FILE *f = segmentFiles[refs[cur].partition];
+        if (fseeko(f, refs[cur].offset, SEEK_SET) != 0 || fgets(line, SEGMENT_LINE_SIZE, f) == NULL) {
+          fprintf(stderr, "ERROR: Could not read back a segment of partition %d\n", refs[cur].partition);
+          return -4;
+        }
+        int64_t length = strcspn(&line[3], "\n") - KMER_LENGTH;
+        memcpy(&contig[posInContig], &line[3+KMER_LENGTH], length * sizeof(char));
+        posInContig += length;
+        links = (line[1] == 'L');
+      }
+
+      contig[posInContig] = '\0';
+      fprintf(outputFile, "%s\n", contig);
+      nContigs++;
+      *totBases += posInContig;
+    }
+    fclose(startFile);
+  }
+
+  for (int p = 0; p < nPartitions; p++) {
+    fclose(segmentFiles[p]);
+    partitionFileName(filename, sizeof(filename), dir, "segments", p);
+    unlink(filename);
+  }
+  free(segmentFiles);
+  free(refs);
+  free(buckets);
+  free(contig);
+  free(line);
+  return nContigs;
+}
+
+#endif // EXTERNAL_ASSEMBLY_H
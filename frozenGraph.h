@@ -0,0 +1,94 @@
+#ifndef FROZEN_GRAPH_H
+#define FROZEN_GRAPH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "commonDefaults.h"
+#include "kmerHash.h"
+#include "mphf.h"
+
+/* Read-only form of the graph used for the traversal once construction is done: the k-mers
+   are stored without next indices in a dense array indexed by a minimal perfect hash, so every
+   lookup is a single probe and the index costs a few bits per k-mer instead of buckets + next */
+
+/* Frozen k-mer data structure */
+typedef struct frozen_kmer_t frozen_kmer_t;
+struct frozen_kmer_t{
+  char kmer[KMER_PACKED_LENGTH];
+  char l_ext;
+  char r_ext;
+};
+
+/* Frozen graph data structure */
+typedef struct frozen_graph_t frozen_graph_t;
+struct frozen_graph_t {
+  mphf_t index;
+  frozen_kmer_t *kmers;  // Dense array, the k-mer with MPHF value i is at kmers[i]
+};
+
+/* Builds the frozen graph from the hash table heap and rewrites the indices in startKmersList
+   to indices into frozen->kmers. The hash table and heap are not modified and can be freed afterwards */
+int freezeGraph(frozen_graph_t *frozen, memory_heap_t *memory_heap, start_kmer_t *startKmersList) {
+  int64_t nKmers = memory_heap->posInHeap;
+
+  frozen->kmers = (frozen_kmer_t*) malloc((nKmers > 0 ? nKmers : 1) * sizeof(frozen_kmer_t));
+  if (frozen->kmers == NULL) {
+    fprintf(stderr, "ERROR: Could not allocate memory for %lld frozen kmers\n", nKmers);
+    return -2;
+  }
+
+  /* Copy the k-mers in heap order, build the MPHF over them and then permute them in place */
+  for (int64_t i = 0; i < nKmers; i++) {
+    kmer_t *cur = heapKmer(memory_heap, i);
+    memcpy(frozen->kmers[i].kmer, cur->kmer, KMER_PACKED_LENGTH * sizeof(char));
+    frozen->kmers[i].l_ext = cur->l_ext;
+    frozen->kmers[i].r_ext = cur->r_ext;
+  }
+
+  if (buildMphf(&frozen->index, frozen->kmers[0].kmer, sizeof(frozen_kmer_t), nKmers) != 0) {
+    fprintf(stderr, "ERROR: Could not build the minimal perfect hash for %lld kmers\n", nKmers);
+    return -1;
+  }
+
+  for (int64_t i = 0; i < nKmers; i++) {
+    int64_t target = lookupMphf(&frozen->index, frozen->kmers[i].kmer);
+    /* Every swap puts one k-mer at its final position */
+    while (target != i) {
+      frozen_kmer_t tmp = frozen->kmers[target];
+      frozen->kmers[target] = frozen->kmers[i];
+      frozen->kmers[i] = tmp;
+      target = lookupMphf(&frozen->index, frozen->kmers[i].kmer);
+    }
+  }
+
+  for (start_kmer_t *cur = startKmersList; cur != NULL; cur = cur->next) {
+    cur->kmerIndex = lookupMphf(&frozen->index, heapKmer(memory_heap, cur->kmerIndex)->kmer);
+  }
+
+  printf("Froze %lld kmers: %d MPHF levels, %.2f bits/kmer of index\n", nKmers, frozen->index.nLevels,
+         nKmers > 0 ? (double) frozen->index.levelOffset[frozen->index.nLevels] * (1.0 + 1.0 / MPHF_RANK_WORDS) / nKmers : 0.0);
+  return 0;
+}
+
+/* Looks up a kmer in the frozen graph and returns a pointer to that entry */
+frozen_kmer_t* lookupFrozenKmer(frozen_graph_t *frozen, const unsigned char *kmer) {
+  char packedKmer[KMER_PACKED_LENGTH];
+  packSequence(kmer, (unsigned char*) packedKmer, KMER_LENGTH);
+
+  int64_t index = lookupMphf(&frozen->index, packedKmer);
+  if (index < 0 || memcmp(packedKmer, frozen->kmers[index].kmer, KMER_PACKED_LENGTH * sizeof(char)) != 0) {
+    return NULL;
+  }
+  return &(frozen->kmers[index]);
+}
+
+/* Deallocate the frozen graph */
+int deallocFrozenGraph(frozen_graph_t *frozen) {
+  deallocMphf(&frozen->index);
+  free(frozen->kmers);
+  return 0;
+}
+
+#endif // FROZEN_GRAPH_H
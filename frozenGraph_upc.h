@@ -0,0 +1,230 @@
+#ifndef FROZEN_GRAPH_UPC_H
+#define FROZEN_GRAPH_UPC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <upc_relaxed.h>
+#include <bupc_collectivev.h>
+
+#include "commonDefaults_upc.h"
+#include "kmerHash_upc.h"
+#include "mphf.h"
+
+/* Read-only form of the distributed graph used for the traversal once construction is done.
+   Each thread builds a minimal perfect hash over the k-mers of its own buckets and stores them,
+   without next indices, in a dense array with its affinity. The MPHFs are only a few bits per
+   k-mer and are replicated on every thread, so a lookup costs a local MPHF evaluation plus one
+   fetch instead of walking a bucket chain through the heap */
+
+/* Frozen k-mer data structure */
+typedef struct frozen_kmer_t frozen_kmer_t;
+struct frozen_kmer_t{
+  char kmer[KMER_PACKED_LENGTH];
+  char lExt;
+  char rExt;
+};
+
+/* Frozen graph data structure */
+typedef struct frozen_graph_t frozen_graph_t;
+struct frozen_graph_t {
+  int64_t tableSize;                // Size and placement of the hash table the graph was frozen from,
+  int placement;                    // together they decide the owner thread
+  mphf_t *index;                    // MPHF of every thread, replicated on all threads
+  shared [1] frozen_kmer_t *kmers;  // K-mer with MPHF value i on thread t is at kmers[i*THREADS + t]
+  frozen_kmer_t **localKmers;       // Private base of each thread's part of kmers, NULL if not castable
+};
+
+/* Returns the thread that owns a kmer given both packed and unpacked, i.e. the affinity of its bucket */
+int frozenKmerOwner(frozen_graph_t *frozen, char *packedKmer, const unsigned char *kmer) {
+  return bucketIndex(frozen->tableSize, frozen->placement, packedKmer, kmer) % THREADS;
+}
+
+/* Builds the frozen graph from the hash table and rewrites the indices in startKmersList to
+   indices into frozen->kmers. Collective. The hash table and heap are not modified and can be
+   freed once this returns */
+void freezeGraph(frozen_graph_t *frozen, hash_table_t *hashtable, memory_heap_t *memoryHeap, start_kmer_t *startKmersList) {
+  int64_t nLocalBuckets = (hashtable->size - MYTHREAD + THREADS - 1) / THREADS;
+  bucket_t *localTable = hashtable->localTables[MYTHREAD];
+  int64_t nLocal = 0, capacity = 1024;
+  frozen_kmer_t *localKmers = malloc(capacity * sizeof(frozen_kmer_t));
+  kmer_t currKmer;
+
+  if (localKmers == NULL) {
+    fprintf(stderr, "ERROR: Could not allocate memory for localKmers in freezeGraph\n");
+    upc_global_exit(1);
+  }
+
+  /* Gather the k-mers of all buckets with our affinity */
+  for (int64_t i = 0; i < nLocalBuckets; i++) {
+    int64_t currIndex = localTable[i].head;
+    while (currIndex != -1) {
+      fetchKmer(memoryHeap, currIndex, &currKmer);
+      if (nLocal == capacity) {
+        capacity *= 2;
+        localKmers = realloc(localKmers, capacity * sizeof(frozen_kmer_t));
+        if (localKmers == NULL) {
+          fprintf(stderr, "ERROR: Could not grow localKmers to %ld entries on thread %d\n", capacity, MYTHREAD);
+          upc_global_exit(1);
+        }
+      }
+      memcpy(localKmers[nLocal].kmer, currKmer.kmer, KMER_PACKED_LENGTH * sizeof(char));
+      localKmers[nLocal].lExt = currKmer.lExt;
+      localKmers[nLocal].rExt = currKmer.rExt;
+      nLocal++;
+      currIndex = currKmer.next;
+    }
+  }
+
+  frozen->tableSize = hashtable->size;
+  frozen->placement = hashtable->placement;
+  frozen->index = calloc(THREADS, sizeof(mphf_t));
+  if (frozen->index == NULL || buildMphf(&frozen->index[MYTHREAD], localKmers[0].kmer, sizeof(frozen_kmer_t), nLocal) != 0) {
+    fprintf(stderr, "ERROR: Could not build the minimal perfect hash for %ld kmers on thread %d\n", nLocal, MYTHREAD);
+    upc_global_exit(1);
+  }
+
+  /* Place our k-mers in the dense array at their MPHF value */
+  int64_t maxLocal = bupc_allv_reduce_all(int64_t, nLocal, UPC_MAX);
+  frozen->kmers = upc_all_alloc(THREADS, (maxLocal > 0 ? maxLocal : 1) * sizeof(frozen_kmer_t));
+  if (frozen->kmers == NULL) {
+    fprintf(stderr, "ERROR: Could not allocate memory for the frozen kmers!\n");
+    upc_global_exit(1);
+  }
+  frozen->localKmers = malloc(THREADS * sizeof(frozen_kmer_t *));
+  if (frozen->localKmers == NULL) {
+    fprintf(stderr, "ERROR: Could not allocate memory for the local frozen kmer bases\n");
+    upc_global_exit(1);
+  }
+  for (int t = 0; t < THREADS; t++) {
+    frozen->localKmers[t] = castToLocal(&frozen->kmers[t]);
+  }
+  frozen_kmer_t *localDense = frozen->localKmers[MYTHREAD];
+  for (int64_t i = 0; i < nLocal; i++) {
+    localDense[lookupMphf(&frozen->index[MYTHREAD], localKmers[i].kmer)] = localKmers[i];
+  }
+  free(localKmers);
+
+  /* Publish our MPHF as nLevels | nKeys | levelOffset[0..nLevels] | bits, and fetch everybody else's */
+  mphf_t *myIndex = &frozen->index[MYTHREAD];
+  int64_t nBitWords = myIndex->levelOffset[myIndex->nLevels] / 64;
+  int64_t nWords = 2 + (myIndex->nLevels + 1) + nBitWords;
+  shared int64_t *publishedSizes = upc_all_alloc(THREADS, sizeof(int64_t));
+  shared [] uint64_t * shared *published = upc_all_alloc(THREADS, sizeof(shared [] uint64_t *));
+  shared [] uint64_t *myPublished = upc_alloc(nWords * sizeof(uint64_t));
+  if (publishedSizes == NULL || published == NULL || myPublished == NULL) {
+    fprintf(stderr, "ERROR: Could not allocate memory to exchange the minimal perfect hashes\n");
+    upc_global_exit(1);
+  }
+  uint64_t *localPublished = (uint64_t *) myPublished;
+  localPublished[0] = myIndex->nLevels;
+  localPublished[1] = myIndex->nKeys;
+  for (int l = 0; l <= myIndex->nLevels; l++) {
+    localPublished[2 + l] = myIndex->levelOffset[l];
+  }
+  memcpy(&localPublished[3 + myIndex->nLevels], myIndex->bits, nBitWords * sizeof(uint64_t));
+  publishedSizes[MYTHREAD] = nWords;
+  published[MYTHREAD] = myPublished;
+  upc_barrier;
+
+  for (int t = 0; t < THREADS; t++) {
+    if (t == MYTHREAD) {
+      continue;
+    }
+    int64_t theirWords = publishedSizes[t];
+    uint64_t *buffer = malloc(theirWords * sizeof(uint64_t));
+    if (buffer == NULL) {
+      fprintf(stderr, "ERROR: Could not allocate memory for the minimal perfect hash of thread %d\n", t);
+      upc_global_exit(1);
+    }
+    upc_memget(buffer, published[t], theirWords * sizeof(uint64_t));
+
+    mphf_t *theirIndex = &frozen->index[t];
+    theirIndex->nLevels = buffer[0];
+    theirIndex->nKeys = buffer[1];
+    for (int l = 0; l <= theirIndex->nLevels; l++) {
+      theirIndex->levelOffset[l] = buffer[2 + l];
+    }
+    int64_t theirBitWords = theirIndex->levelOffset[theirIndex->nLevels] / 64;
+    theirIndex->bits = malloc((theirBitWords > 0 ? theirBitWords : 1) * sizeof(uint64_t));
+    if (theirIndex->bits == NULL) {
+      fprintf(stderr, "ERROR: Could not allocate memory for the minimal perfect hash of thread %d\n", t);
+      upc_global_exit(1);
+    }
+    memcpy(theirIndex->bits, &buffer[3 + theirIndex->nLevels], theirBitWords * sizeof(uint64_t));
+    free(buffer);
+    if (computeMphfRanks(theirIndex) != 0) {
+      fprintf(stderr, "ERROR: Could not allocate memory for the minimal perfect hash of thread %d\n", t);
+      upc_global_exit(1);
+    }
+  }
+
+  /* Start nodes now point into the frozen graph */
+  // unpackSequence() writes whole 4-mers and then the terminating '\0'
+  unsigned char unpackedKmer[4*KMER_PACKED_LENGTH+1];
+  for (start_kmer_t *curr = startKmersList; curr != NULL; curr = curr->next) {
+    fetchKmer(memoryHeap, curr->kmerIndex, &currKmer);
+    // Only minimizer placement needs the unpacked k-mer to find the owner
+    if (frozen->placement == PLACEMENT_MINIMIZER) {
+      unpackSequence((unsigned char*) currKmer.kmer, unpackedKmer, KMER_LENGTH);
+    }
+    int owner = frozenKmerOwner(frozen, currKmer.kmer, unpackedKmer);
+    curr->kmerIndex = lookupMphf(&frozen->index[owner], currKmer.kmer) * THREADS + owner;
+  }
+
+  // Everybody must be done reading the published MPHFs and the heap before they are freed
+  upc_barrier;
+  upc_free(myPublished);
+  upc_all_free(published);
+  upc_all_free(publishedSizes);
+
+  int64_t totalKmers = bupc_allv_reduce(int64_t, nLocal, ROOT, UPC_ADD);
+  if (MYTHREAD == ROOT && totalKmers > 0) {
+    int64_t indexBits = 0;
+    for (int t = 0; t < THREADS; t++) {
+      indexBits += frozen->index[t].levelOffset[frozen->index[t].nLevels];
+    }
+    printf("Froze %ld kmers: %.2f bits/kmer of index (replicated on every thread)\n", totalKmers,
+           (double) indexBits * (1.0 + 1.0 / MPHF_RANK_WORDS) / totalKmers);
+  }
+}
+
+/* Copies the frozen kmer at index into result, directly if its thread is castable */
+void fetchFrozenKmer(frozen_graph_t *frozen, int64_t index, frozen_kmer_t *result) {
+  frozen_kmer_t *localKmers = frozen->localKmers[index % THREADS];
+
+  countAccess(index % THREADS, localKmers);
+  if (localKmers != NULL) {
+    *result = localKmers[index / THREADS];
+  }
+  else {
+    upc_memget(result, &frozen->kmers[index], sizeof(frozen_kmer_t));
+  }
+}
+
+/* Looks up a kmer in the frozen graph and copies it into result. Returns 0 on success */
+int lookupFrozenKmer(frozen_graph_t *frozen, frozen_kmer_t *result, const unsigned char *kmer) {
+  char packedKmer[KMER_PACKED_LENGTH];
+  packSequence(kmer, (unsigned char*) packedKmer, KMER_LENGTH);
+  int owner = frozenKmerOwner(frozen, packedKmer, kmer);
+
+  int64_t index = lookupMphf(&frozen->index[owner], packedKmer);
+  if (index < 0) {
+    return 1;
+  }
+  fetchFrozenKmer(frozen, index * THREADS + owner, result);
+  return memcmp(packedKmer, result->kmer, KMER_PACKED_LENGTH * sizeof(char)) != 0;
+}
+
+/* Deallocate the frozen graph. Collective */
+int deallocFrozenGraph(frozen_graph_t *frozen) {
+  for (int t = 0; t < THREADS; t++) {
+    deallocMphf(&frozen->index[t]);
+  }
+  free(frozen->index);
+  free(frozen->localKmers);
+  upc_all_free(frozen->kmers);
+  return 0;
+}
+
+#endif // FROZEN_GRAPH_UPC_H
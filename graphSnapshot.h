@@ -0,0 +1,212 @@
+#ifndef GRAPH_SNAPSHOT_H
+#define GRAPH_SNAPSHOT_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "commonDefaults.h"
+#include "kmerHash.h"
+
+/* A snapshot is the constructed graph dumped as one flat file:
+     header | buckets[tableSize] | heap[nKmers] | start indices[nStartKmers]
+   Buckets and kmer_t entries only hold heap indices, so the file can be mmap'ed
+   anywhere and traversed in place without any pointer fix-ups. */
+
+#define SNAPSHOT_MAGIC "KMERSNAP"
+#define SNAPSHOT_VERSION 1
+
+/* Snapshot file header (all offsets are in bytes from the start of the file) */
+typedef struct snapshot_header_t snapshot_header_t;
+struct snapshot_header_t {
+  char magic[8];
+  int32_t version;
+  int32_t kmerLength;          // KMER_LENGTH the graph was built with
+  int32_t kmerPackedLength;    // KMER_PACKED_LENGTH the graph was built with
+  int32_t kmerSize;            // sizeof(kmer_t) of the writer, guards against layout changes
+  int64_t tableSize;           // Number of buckets
+  int64_t nKmers;              // Number of used heap entries
+  int64_t nStartKmers;         // Number of start k-mer indices
+  int64_t tableOffset;
+  int64_t heapOffset;
+  int64_t startOffset;
+  int64_t totalSize;
+};
+
+/* Mapping of a loaded snapshot, needed to release it */
+typedef struct graph_snapshot_t graph_snapshot_t;
+struct graph_snapshot_t {
+  void *base;
+  size_t size;
+};
+
+/* Writes the hash table, the used part of the heap and the start k-mers to filename */
+int writeGraphSnapshot(const char *filename, hash_table_t *hashtable, memory_heap_t *memory_heap, start_kmer_t *startKmersList) {
+  snapshot_header_t header;
+  start_kmer_t *cur;
+  int64_t index;
+
+  /* Only a single table can be written */
+  finishRehash(hashtable, memory_heap);
+
+  memset(&header, 0, sizeof(snapshot_header_t));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.kmerLength = KMER_LENGTH;
+  header.kmerPackedLength = KMER_PACKED_LENGTH;
+  header.kmerSize = sizeof(kmer_t);
+  header.tableSize = hashtable->size;
+  header.nKmers = memory_heap->posInHeap;
+  for (cur = startKmersList; cur != NULL; cur = cur->next) {
+    header.nStartKmers++;
+  }
+  header.tableOffset = sizeof(snapshot_header_t);
+  header.heapOffset = header.tableOffset + header.tableSize * sizeof(bucket_t);
+  header.startOffset = header.heapOffset + header.nKmers * sizeof(kmer_t);
+  header.totalSize = header.startOffset + header.nStartKmers * sizeof(int64_t);
+
+  FILE *f = fopen(filename, "w");
+  if (f == NULL) {
+    fprintf(stderr, "Could not open %s for writing!\n", filename);
+    return -1;
+  }
+
+  if (fwrite(&header, sizeof(snapshot_header_t), 1, f) != 1 ||
+      fwrite(hashtable->table, sizeof(bucket_t), header.tableSize, f) != header.tableSize) {
+    fprintf(stderr, "Could not write graph snapshot %s\n", filename);
+    fclose(f);
+    return -2;
+  }
+
+  /* The heap segments are written back to back, so the file holds one contiguous heap */
+  for (index = 0; index < header.nKmers; index += HEAP_SEGMENT_SIZE) {
+    int64_t count = (header.nKmers - index < HEAP_SEGMENT_SIZE) ? header.nKmers - index : HEAP_SEGMENT_SIZE;
+    if (fwrite(memory_heap->segments[index >> HEAP_SEGMENT_BITS], sizeof(kmer_t), count, f) != count) {
+      fprintf(stderr, "Could not write graph snapshot %s\n", filename);
+      fclose(f);
+      return -2;
+    }
+  }
+
+  for (cur = startKmersList; cur != NULL; cur = cur->next) {
+    index = cur->kmerIndex;
+    if (fwrite(&index, sizeof(int64_t), 1, f) != 1) {
+      fprintf(stderr, "Could not write graph snapshot %s\n", filename);
+      fclose(f);
+      return -2;
+    }
+  }
+
+  if (fclose(f) != 0) {
+    fprintf(stderr, "Could not close graph snapshot %s\n", filename);
+    return -3;
+  }
+  printf("Wrote graph snapshot with %lld kmers to %s\n", header.nKmers, filename);
+  return 0;
+}
+
+/* Maps a snapshot written by writeGraphSnapshot and points the hash table and the heap into it.
+   The mapping is read-only, so the graph cannot be added to. Returns NULL on failure. The start list is rebuilt in the same order it was written in */
+hash_table_t* loadGraphSnapshot(const char *filename, memory_heap_t *memory_heap, start_kmer_t **startKmersList, graph_snapshot_t *snapshot) {
+  int fd = open(filename, O_RDONLY);
+  if (fd < 0) {
+    fprintf(stderr, "Could not open %s for reading!\n", filename);
+    return NULL;
+  }
+
+  struct stat buf;
+  if (fstat(fd, &buf) != 0 || buf.st_size < (off_t) sizeof(snapshot_header_t)) {
+    fprintf(stderr, "Graph snapshot %s is too short\n", filename);
+    close(fd);
+    return NULL;
+  }
+
+  void *base = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "Could not mmap %s\n", filename);
+    return NULL;
+  }
+
+  snapshot_header_t *header = (snapshot_header_t*) base;
+  if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != SNAPSHOT_VERSION) {
+    fprintf(stderr, "%s is not a version %d graph snapshot\n", filename, SNAPSHOT_VERSION);
+    munmap(base, buf.st_size);
+    return NULL;
+  }
+  if (header->kmerLength != KMER_LENGTH || header->kmerPackedLength != KMER_PACKED_LENGTH || header->kmerSize != sizeof(kmer_t)) {
+    fprintf(stderr, "Graph snapshot %s was built for kmer length %d, expected %d\n", filename, header->kmerLength, KMER_LENGTH);
+    munmap(base, buf.st_size);
+    return NULL;
+  }
+  /* The sections must be laid out exactly as writeGraphSnapshot does, so that all of them are inside the mapping */
+  if (header->tableSize < 0 || header->nKmers < 0 || header->nStartKmers < 0 ||
+      header->tableOffset != sizeof(snapshot_header_t) ||
+      header->heapOffset != header->tableOffset + header->tableSize * (int64_t) sizeof(bucket_t) ||
+      header->startOffset != header->heapOffset + header->nKmers * (int64_t) sizeof(kmer_t) ||
+      header->totalSize != header->startOffset + header->nStartKmers * (int64_t) sizeof(int64_t)) {
+    fprintf(stderr, "Graph snapshot %s has an inconsistent header\n", filename);
+    munmap(base, buf.st_size);
+    return NULL;
+  }
+  if (header->totalSize != buf.st_size) {
+    fprintf(stderr, "Graph snapshot %s is truncated\n", filename);
+    munmap(base, buf.st_size);
+    return NULL;
+  }
+
+  hash_table_t *result = (hash_table_t*) malloc(sizeof(hash_table_t));
+  result->size = header->tableSize;
+  result->table = (bucket_t*) ((char*) base + header->tableOffset);
+  result->nEntries = header->nKmers;
+  result->oldSize = 0;
+  result->oldTable = NULL;
+  result->rehashPos = 0;
+
+  /* The heap segments point into the contiguous heap of the file */
+  kmer_t *heap = (kmer_t*) ((char*) base + header->heapOffset);
+  memory_heap->nSegments = (header->nKmers + HEAP_SEGMENT_SIZE - 1) / HEAP_SEGMENT_SIZE;
+  memory_heap->segments = (kmer_t**) malloc((memory_heap->nSegments + 1) * sizeof(kmer_t*));
+  for (int64_t i = 0; i < memory_heap->nSegments; i++) {
+    memory_heap->segments[i] = heap + i * HEAP_SEGMENT_SIZE;
+  }
+  memory_heap->posInHeap = header->nKmers;
+
+  /* Rebuild the start list back to front so it keeps the order it was written in */
+  int64_t *startIndices = (int64_t*) ((char*) base + header->startOffset);
+  for (int64_t i = header->nStartKmers - 1; i >= 0; i--) {
+    start_kmer_t *new_entry = (start_kmer_t*) malloc(sizeof(start_kmer_t));
+    new_entry->next = (*startKmersList);
+    new_entry->kmerIndex = startIndices[i];
+    (*startKmersList) = new_entry;
+  }
+
+  snapshot->base = base;
+  snapshot->size = buf.st_size;
+  printf("Mapped graph snapshot with %lld kmers from %s\n", header->nKmers, filename);
+  return result;
+}
+
+/* Releases a snapshot mapped by loadGraphSnapshot. Use instead of deallocHeap/deallocHashtable */
+int unmapGraphSnapshot(graph_snapshot_t *snapshot) {
+  munmap(snapshot->base, snapshot->size);
+  snapshot->base = NULL;
+  return 0;
+}
+
+/* Releases the hash table and the heap, whether they were built or mapped from a snapshot */
+int deallocGraph(hash_table_t *hashtable, memory_heap_t *memory_heap, graph_snapshot_t *snapshot) {
+  if (snapshot->base != NULL) {
+    free(memory_heap->segments);
+    return unmapGraphSnapshot(snapshot);
+  }
+  deallocHeap(memory_heap);
+  return deallocHashtable(hashtable);
+}
+
+#endif // GRAPH_SNAPSHOT_H
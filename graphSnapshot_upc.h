@@ -0,0 +1,178 @@
+#ifndef GRAPH_SNAPSHOT_UPC_H
+#define GRAPH_SNAPSHOT_UPC_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <upc_relaxed.h>
+
+#include "commonDefaults_upc.h"
+#include "kmerHash_upc.h"
+
+/* Per-thread graph snapshot. Every thread dumps the part of the table and of the heap that has
+   affinity to it into <prefix>-<MYTHREAD>:
+     header | local buckets[nLocalBuckets] | local heap[posInHeap] | local start indices[nStartKmers]
+   Buckets and kmer_t entries only hold global heap indices, so a snapshot is reloaded with a plain
+   local copy into the shared table and heap, without going through addKmer() */
+
+#define SNAPSHOT_MAGIC "KMERSNPU"
+#define SNAPSHOT_VERSION 2
+
+/* Snapshot file header (all offsets are in bytes from the start of the file) */
+typedef struct snapshot_header_t snapshot_header_t;
+struct snapshot_header_t {
+  char magic[8];
+  int32_t version;
+  int32_t kmerLength;          // KMER_LENGTH the graph was built with
+  int32_t kmerPackedLength;    // KMER_PACKED_LENGTH the graph was built with
+  int32_t kmerSize;            // sizeof(kmer_t) of the writer, guards against layout changes
+  int32_t threads;             // THREADS the graph was built with
+  int32_t thread;              // MYTHREAD of the writer
+  int32_t placement;           // PLACEMENT_HASH or PLACEMENT_MINIMIZER
+  int64_t nKmers;              // Number of k-mers over all threads
+  int64_t tableSize;           // Number of buckets over all threads
+  int64_t heapBlockSize;       // Heap entries reserved per thread
+  int64_t nLocalBuckets;       // Number of buckets with affinity to the writer
+  int64_t posInHeap;           // Number of used local heap entries
+  int64_t nStartKmers;         // Number of local start k-mer indices
+  int64_t tableOffset;
+  int64_t heapOffset;
+  int64_t startOffset;
+  int64_t totalSize;
+};
+
+/* Number of buckets with affinity to MYTHREAD in a table of tableSize buckets */
+int64_t localBucketCount(int64_t tableSize) {
+  return (tableSize - MYTHREAD + THREADS - 1) / THREADS;
+}
+
+/* Writes this thread's part of the graph to <prefix>-<MYTHREAD> */
+void writeGraphSnapshot(const char *prefix, hash_table_t *hashtable, memory_heap_t *memoryHeap, int64_t nKmers, int64_t heapBlockSize, start_kmer_t *startKmersList) {
+  snapshot_header_t header;
+  start_kmer_t *curr;
+  char filename[256];
+
+  memset(&header, 0, sizeof(snapshot_header_t));
+  memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+  header.version = SNAPSHOT_VERSION;
+  header.kmerLength = KMER_LENGTH;
+  header.kmerPackedLength = KMER_PACKED_LENGTH;
+  header.kmerSize = sizeof(kmer_t);
+  header.threads = THREADS;
+  header.thread = MYTHREAD;
+  header.placement = hashtable->placement;
+  header.nKmers = nKmers;
+  header.tableSize = hashtable->size;
+  header.heapBlockSize = heapBlockSize;
+  header.nLocalBuckets = localBucketCount(hashtable->size);
+  header.posInHeap = memoryHeap->posInHeap;
+  for (curr = startKmersList; curr != NULL; curr = curr->next) {
+    header.nStartKmers++;
+  }
+  header.tableOffset = sizeof(snapshot_header_t);
+  header.heapOffset = header.tableOffset + header.nLocalBuckets * sizeof(bucket_t);
+  header.startOffset = header.heapOffset + header.posInHeap * sizeof(kmer_t);
+  header.totalSize = header.startOffset + header.nStartKmers * sizeof(int64_t);
+
+  // Elements with affinity to MYTHREAD are contiguous in local memory
+  bucket_t *localTable = hashtable->localTables[MYTHREAD];
+  kmer_t *localHeap = memoryHeap->localHeaps[MYTHREAD];
+
+  snprintf(filename, sizeof(filename), "%s-%d", prefix, MYTHREAD);
+  FILE *f = fopen(filename, "w");
+  if (f == NULL) {
+    fprintf(stderr, "ERROR: Could not open %s for writing on thread %d\n", filename, MYTHREAD);
+    upc_global_exit(1);
+  }
+
+  int failed = fwrite(&header, sizeof(snapshot_header_t), 1, f) != 1 ||
+    fwrite(localTable, sizeof(bucket_t), header.nLocalBuckets, f) != header.nLocalBuckets ||
+    fwrite(localHeap, sizeof(kmer_t), header.posInHeap, f) != header.posInHeap;
+  for (curr = startKmersList; curr != NULL && !failed; curr = curr->next) {
+    failed = fwrite(&curr->kmerIndex, sizeof(int64_t), 1, f) != 1;
+  }
+  if (fclose(f) != 0 || failed) {
+    fprintf(stderr, "ERROR: Could not write graph snapshot %s on thread %d\n", filename, MYTHREAD);
+    upc_global_exit(1);
+  }
+}
+
+/* Loads this thread's part of a graph written by writeGraphSnapshot with the same THREADS.
+   Collective: allocates the shared table and heap through createHashTable. Returns the number of
+   local start k-mers that were added to startKmersList, and stores the total k-mer count and the
+   heap block size of the graph in nKmers and heapBlockSize so that it can be written out again */
+int64_t loadGraphSnapshot(const char *prefix, hash_table_t **hashtable, memory_heap_t *memoryHeap, start_kmer_t **startKmersList, int64_t *nKmers, int64_t *heapBlockSize) {
+  char filename[256];
+  snprintf(filename, sizeof(filename), "%s-%d", prefix, MYTHREAD);
+
+  int fd = open(filename, O_RDONLY);
+  struct stat buf;
+  if (fd < 0 || fstat(fd, &buf) != 0 || buf.st_size < (off_t) sizeof(snapshot_header_t)) {
+    fprintf(stderr, "ERROR: Could not read graph snapshot %s on thread %d\n", filename, MYTHREAD);
+    upc_global_exit(1);
+  }
+
+  void *base = mmap(NULL, buf.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (base == MAP_FAILED) {
+    fprintf(stderr, "ERROR: Could not mmap %s on thread %d\n", filename, MYTHREAD);
+    upc_global_exit(1);
+  }
+
+  snapshot_header_t *header = (snapshot_header_t *) base;
+  if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0 || header->version != SNAPSHOT_VERSION ||
+      header->kmerLength != KMER_LENGTH || header->kmerPackedLength != KMER_PACKED_LENGTH || header->kmerSize != sizeof(kmer_t) ||
+      header->totalSize != buf.st_size) {
+    fprintf(stderr, "ERROR: %s is not a version %d graph snapshot for kmer length %d\n", filename, SNAPSHOT_VERSION, KMER_LENGTH);
+    upc_global_exit(1);
+  }
+  if (header->threads != THREADS || header->thread != MYTHREAD) {
+    fprintf(stderr, "ERROR: %s was written by thread %d of %d, cannot load on thread %d of %d\n", filename, header->thread, header->threads, MYTHREAD, THREADS);
+    upc_global_exit(1);
+  }
+
+  /* The sections must be laid out exactly as writeGraphSnapshot() does, so that all of them are inside the mapping */
+  if (header->nLocalBuckets < 0 || header->posInHeap < 0 || header->nStartKmers < 0 ||
+      header->nLocalBuckets != localBucketCount(header->tableSize) || header->posInHeap > header->heapBlockSize ||
+      header->tableOffset != sizeof(snapshot_header_t) ||
+      header->heapOffset != header->tableOffset + header->nLocalBuckets * (int64_t) sizeof(bucket_t) ||
+      header->startOffset != header->heapOffset + header->posInHeap * (int64_t) sizeof(kmer_t) ||
+      header->totalSize != header->startOffset + header->nStartKmers * (int64_t) sizeof(int64_t)) {
+    fprintf(stderr, "ERROR: %s has an inconsistent header\n", filename);
+    upc_global_exit(1);
+  }
+
+  // K-mer count, heap block size and placement are the same in every thread's header
+  *hashtable = createHashTable(header->nKmers, memoryHeap, header->heapBlockSize, header->placement);
+  if ((*hashtable)->size != header->tableSize) {
+    fprintf(stderr, "ERROR: %s was written with a different LOAD_FACTOR\n", filename);
+    upc_global_exit(1);
+  }
+
+  bucket_t *localTable = (*hashtable)->localTables[MYTHREAD];
+  kmer_t *localHeap = memoryHeap->localHeaps[MYTHREAD];
+
+  // createHashTable() only empties the buckets with our affinity, so they can be overwritten right away
+  memcpy(localTable, (char *) base + header->tableOffset, header->nLocalBuckets * sizeof(bucket_t));
+  memcpy(localHeap, (char *) base + header->heapOffset, header->posInHeap * sizeof(kmer_t));
+  memoryHeap->posInHeap = header->posInHeap;
+  memoryHeap->heapFill[MYTHREAD] = header->posInHeap;
+  *nKmers = header->nKmers;
+  *heapBlockSize = header->heapBlockSize;
+
+  int64_t *startIndices = (int64_t *) ((char *) base + header->startOffset);
+  int64_t nStartKmers = header->nStartKmers;
+  for (int64_t i = nStartKmers - 1; i >= 0; i--) {
+    addKmerToStartList(memoryHeap, startKmersList, startIndices[i]);
+  }
+
+  munmap(base, buf.st_size);
+  return nStartKmers;
+}
+
+#endif // GRAPH_SNAPSHOT_UPC_H
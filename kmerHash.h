@@ -9,29 +9,62 @@
 
 #include "commonDefaults.h"
 
-/* Creates a hash table and (pre)allocates memory for the memory heap */
+/* Allocates n_buckets empty buckets */
+bucket_t* allocBuckets(int64_t n_buckets) {
+  bucket_t *result = (bucket_t*) malloc(n_buckets * sizeof(bucket_t));
+  
+  if (result == NULL) {
+    fprintf(stderr, "ERROR: Could not allocate memory for the hash table: %lld buckets of %lu bytes\n", n_buckets, sizeof(bucket_t));
+    fprintf(stderr, "ERROR: Are you sure that your input is of the correct KMER_LENGTH in Makefile?\n");
+    exit(1);
+  }
+  
+  /* All bytes set to 0xff is -1, the flag indicating a bucket is empty */
+  memset(result, 0xff, n_buckets * sizeof(bucket_t));
+  return result;
+}
+
+/* Creates a hash table sized for nEntries k-mers (0 if unknown, e.g. for streams) and an empty memory heap.
+   Both grow as k-mers are added, so nEntries is only a hint that avoids rehashing */
 hash_table_t* createHashTable(int64_t nEntries, memory_heap_t *memory_heap) {
   hash_table_t *result;
   int64_t n_buckets = nEntries * LOAD_FACTOR;
+  if (n_buckets < MIN_TABLE_SIZE) {
+    n_buckets = MIN_TABLE_SIZE;
+  }
   
   result = (hash_table_t*) malloc(sizeof(hash_table_t));
   result->size = n_buckets;
-  result->table = (bucket_t*) calloc(n_buckets , sizeof(bucket_t));
+  result->table = allocBuckets(n_buckets);
+  result->nEntries = 0;
+  result->oldSize = 0;
+  result->oldTable = NULL;
+  result->rehashPos = 0;
+  
+  memory_heap->segments = NULL;
+  memory_heap->nSegments = 0;
+  memory_heap->posInHeap = 0;
   
-  if (result->table == NULL) {
-    fprintf(stderr, "ERROR: Could not allocate memory for the hash table: %lld buckets of %lu bytes\n", n_buckets, sizeof(bucket_t));
-    fprintf(stderr, "ERROR: Are you sure that your input is of the correct KMER_LENGTH in Makefile?\n");
-    exit(1);
-  }
+  return result;
+}
+
+/* Returns a pointer to the heap entry at index */
+kmer_t* heapKmer(memory_heap_t *memory_heap, int64_t index) {
+  return &(memory_heap->segments[index >> HEAP_SEGMENT_BITS][index & (HEAP_SEGMENT_SIZE-1)]);
+}
+
+/* Appends a segment of HEAP_SEGMENT_SIZE entries to the heap. Existing entries never move */
+void addHeapSegment(memory_heap_t *memory_heap) {
+  kmer_t **segments = (kmer_t**) realloc(memory_heap->segments, (memory_heap->nSegments + 1) * sizeof(kmer_t*));
+  kmer_t *segment = (kmer_t*) malloc(HEAP_SEGMENT_SIZE * sizeof(kmer_t));
   
-  memory_heap->heap = (kmer_t *) malloc(nEntries * sizeof(kmer_t));
-  if (memory_heap->heap == NULL) {
+  if (segments == NULL || segment == NULL) {
     fprintf(stderr, "ERROR: Could not allocate memory for the heap!\n");
     exit(1);
   }
-  memory_heap->posInHeap = 0;
-  
-  return result;
+  segments[memory_heap->nSegments] = segment;
+  memory_heap->segments = segments;
+  memory_heap->nSegments++;
 }
 
 /* Auxiliary function for computing hash values */
@@ -50,49 +83,113 @@ int64_t hashKmer(int64_t  hashtable_size, char *seq) {
   return hashSeq(hashtable_size, seq, KMER_PACKED_LENGTH);
 }
 
+/* Moves up to n_buckets buckets of the old table into the new one. Only the next indices are
+   relinked, the k-mers stay where they are in the heap */
+void rehashStep(hash_table_t *hashtable, memory_heap_t *memory_heap, int64_t n_buckets) {
+  for (; n_buckets > 0 && hashtable->rehashPos < hashtable->oldSize; n_buckets--) {
+    int64_t cur_index = hashtable->oldTable[hashtable->rehashPos].head;
+    while (cur_index != -1) {
+      kmer_t *cur = heapKmer(memory_heap, cur_index);
+      int64_t next_index = cur->next;
+      int64_t hashval = hashKmer(hashtable->size, cur->kmer);
+      cur->next = hashtable->table[hashval].head;
+      hashtable->table[hashval].head = cur_index;
+      cur_index = next_index;
+    }
+    hashtable->rehashPos++;
+  }
+  
+  if (hashtable->oldTable != NULL && hashtable->rehashPos == hashtable->oldSize) {
+    free(hashtable->oldTable);
+    hashtable->oldTable = NULL;
+    hashtable->oldSize = 0;
+  }
+}
+
+/* Completes a rehash in progress, if any */
+void finishRehash(hash_table_t *hashtable, memory_heap_t *memory_heap) {
+  if (hashtable->oldTable != NULL) {
+    rehashStep(hashtable, memory_heap, hashtable->oldSize);
+  }
+}
+
+/* Doubles the number of buckets. The old buckets are moved over REHASH_STEP at a time by the
+   following inserts instead of all at once, so growing never stalls construction */
+void growHashTable(hash_table_t *hashtable, memory_heap_t *memory_heap) {
+  finishRehash(hashtable, memory_heap);
+  hashtable->oldTable = hashtable->table;
+  hashtable->oldSize = hashtable->size;
+  hashtable->rehashPos = 0;
+  hashtable->size *= 2;
+  hashtable->table = allocBuckets(hashtable->size);
+}
+
+/* Returns the bucket that holds a packed kmer: its old bucket if that one has not been moved yet */
+bucket_t* bucketOf(hash_table_t *hashtable, char *packedKmer) {
+  if (hashtable->oldTable != NULL) {
+    int64_t old_hashval = hashKmer(hashtable->oldSize, packedKmer);
+    if (old_hashval >= hashtable->rehashPos) {
+      return &(hashtable->oldTable[old_hashval]);
+    }
+  }
+  return &(hashtable->table[hashKmer(hashtable->size, packedKmer)]);
+}
+
 /* Looks up a kmer in the hash table and returns a pointer to that entry */
-kmer_t* lookupKmer(hash_table_t *hashtable, const unsigned char *kmer) {
+kmer_t* lookupKmer(hash_table_t *hashtable, memory_heap_t *memory_heap, const unsigned char *kmer) {
   
   char packedKmer[KMER_PACKED_LENGTH];
   packSequence(kmer, (unsigned char*) packedKmer, KMER_LENGTH);
-  int64_t hashval = hashKmer(hashtable->size, (char*) packedKmer);
-  bucket_t cur_bucket;
+  int64_t cur_index;
   kmer_t *result;
   
-  cur_bucket = hashtable->table[hashval];
-  result = cur_bucket.head;
+  cur_index = bucketOf(hashtable, packedKmer)->head;
   
-  for (; result!=NULL; ) {
+  for (; cur_index != -1; ) {
+    result = heapKmer(memory_heap, cur_index);
     if ( memcmp(packedKmer, result->kmer, KMER_PACKED_LENGTH * sizeof(char)) == 0 ) {
       return result;
     }
-    result = result->next;
+    cur_index = result->next;
   }
   return NULL;
   
 }
 
-/* Adds a kmer and its extensions in the hash table (note that memory heap must be preallocated!) */
+/* Adds a kmer and its extensions in the hash table, growing the heap and the table as needed */
 int addKmer(hash_table_t *hashtable, memory_heap_t *memory_heap, const unsigned char *kmer, char left_ext, char right_ext) {
   
+  /* Make room for one more k-mer */
+  if (memory_heap->posInHeap == memory_heap->nSegments * HEAP_SEGMENT_SIZE) {
+    addHeapSegment(memory_heap);
+  }
+  if ((hashtable->nEntries + 1) * LOAD_FACTOR > hashtable->size) {
+    growHashTable(hashtable, memory_heap);
+  }
+  if (hashtable->oldTable != NULL) {
+    rehashStep(hashtable, memory_heap, REHASH_STEP);
+  }
+  
   /* Pack a k-mer sequence appropriately */
   char packedKmer[KMER_PACKED_LENGTH];
   packSequence(kmer, (unsigned char*) packedKmer, KMER_LENGTH);
-  int64_t hashval = hashKmer(hashtable->size, (char*) packedKmer);
+  bucket_t *bucket = bucketOf(hashtable, packedKmer);
   int64_t pos = memory_heap->posInHeap;
+  kmer_t *entry = heapKmer(memory_heap, pos);
   
   /* Add the contents to the appropriate kmer struct in the heap */
-  memcpy((memory_heap->heap[pos]).kmer, packedKmer, KMER_PACKED_LENGTH * sizeof(char));
-  (memory_heap->heap[pos]).l_ext = left_ext;
-  (memory_heap->heap[pos]).r_ext = right_ext;
+  memcpy(entry->kmer, packedKmer, KMER_PACKED_LENGTH * sizeof(char));
+  entry->l_ext = left_ext;
+  entry->r_ext = right_ext;
   
-  /* Fix the next pointer to point to the appropriate kmer struct */
-  (memory_heap->heap[pos]).next = hashtable->table[hashval].head;
-  /* Fix the head pointer of the appropriate bucket to point to the current kmer */
-  hashtable->table[hashval].head = &(memory_heap->heap[pos]);
+  /* Fix the next index to point to the appropriate kmer struct */
+  entry->next = bucket->head;
+  /* Fix the head index of the appropriate bucket to point to the current kmer */
+  bucket->head = pos;
   
   /* Increase the heap pointer */
   memory_heap->posInHeap++;
+  hashtable->nEntries++;
   
   return 0;
   
@@ -101,25 +198,27 @@ int addKmer(hash_table_t *hashtable, memory_heap_t *memory_heap, const unsigned
 /* Adds a k-mer in the start list by using the memory heap (note that the k-mer was "just added" in the memory heap at position posInHeap - 1) */
 void addKmerToStartList(memory_heap_t *memory_heap, start_kmer_t **startKmersList) {
   start_kmer_t *new_entry;
-  kmer_t *ptrToKmer;
   
   int64_t prevPosInHeap = memory_heap->posInHeap - 1;
-  ptrToKmer = &(memory_heap->heap[prevPosInHeap]);
   new_entry = (start_kmer_t*) malloc(sizeof(start_kmer_t));
   new_entry->next = (*startKmersList);
-  new_entry->kmerPtr = ptrToKmer;
+  new_entry->kmerIndex = prevPosInHeap;
   (*startKmersList) = new_entry;
 }
 
 /* Deallocate heap. Call before calling deallocHashtable */
 int deallocHeap(memory_heap_t *memory_heap) {
-  free(memory_heap->heap);
+  for (int64_t i = 0; i < memory_heap->nSegments; i++) {
+    free(memory_heap->segments[i]);
+  }
+  free(memory_heap->segments);
   return 0;
 }
 
 /** Deallocate hashtable */
 int deallocHashtable(hash_table_t *hashtable) {
   free(hashtable->table);
+  free(hashtable->oldTable);
   return 0;
 }
 
@@ -6,13 +6,83 @@
 #include <sys/time.h>
 #include <math.h>
 #include <upc_relaxed.h>
+#include <bupc_collectivev.h>
 #include "commonDefaults_upc.h"
+#include "minimizer.h"
 
-/* Creates a hash table and (pre)allocates memory for the memory heap */
-hash_table_t* createHashTable(int64_t nEntries, memory_heap_t *memoryHeap, int64_t heapBlockSize) {
+/* Table, heap and frozen k-mer reads of this thread that were served from its own memory, from
+   the memory of another castable thread, or through the runtime */
+int64_t ownAccesses = 0, castableAccesses = 0, remoteAccesses = 0;
+
+/* Returns a private pointer to ptr if its memory can be addressed directly by this thread
+   (same thread, or same node with Berkeley UPC's shared memory support), NULL otherwise */
+void *castToLocal(shared void *ptr) {
+#ifdef __BERKELEY_UPC__
+  return bupc_cast(ptr);
+#else
+  return (upc_threadof(ptr) == MYTHREAD) ? (void *) ptr : NULL;
+#endif
+}
+
+/* Counts a read of an element with affinity to thread, whose private base is localBase */
+void countAccess(int thread, void *localBase) {
+  if (thread == MYTHREAD) {
+    ownAccesses++;
+  }
+  else if (localBase != NULL) {
+    castableAccesses++;
+  }
+  else {
+    remoteAccesses++;
+  }
+}
+
+/* Returns the thread an unpacked kmer is placed on with PLACEMENT_MINIMIZER */
+int minimizerOwner(const unsigned char *kmer) {
+  return minimizerHash(kmer) % THREADS;
+}
+
+/* Returns the heap entries to reserve per thread when the nKmers UFX lines in buffer are placed
+   by minimizer, i.e. the largest number of k-mers that any thread receives. Collective */
+int64_t minimizerHeapBlockSize(const unsigned char *buffer, int64_t nKmers) {
+  shared int64_t *ownerCounts = upc_all_alloc(THREADS, sizeof(int64_t));
+  int64_t *localCounts = calloc(THREADS, sizeof(int64_t));
+  
+  if ((ownerCounts == NULL) || (localCounts == NULL)) {
+    fprintf(stderr, "ERROR: Could not allocate memory for the per-thread k-mer counts\n");
+    upc_global_exit(1);
+  }
+  
+  ownerCounts[MYTHREAD] = 0;
+  for (int64_t i = 0; i < nKmers; ++i) {
+    localCounts[minimizerOwner(&buffer[i * LINE_SIZE])]++;
+  }
+  upc_barrier;
+  
+  for (int t = 0; t < THREADS; ++t) {
+    if (localCounts[t] > 0) {
+      bupc_atomicI64_fetchadd_relaxed(&ownerCounts[t], localCounts[t]);
+    }
+  }
+  upc_barrier;
+  
+  int64_t blockSize = bupc_allv_reduce_all(int64_t, ownerCounts[MYTHREAD], UPC_MAX);
+  upc_all_free(ownerCounts);
+  free(localCounts);
+  return blockSize;
+}
+
+/* Creates a hash table and (pre)allocates memory for the memory heap. With PLACEMENT_MINIMIZER
+   heapBlockSize must come from minimizerHeapBlockSize(). Collective */
+hash_table_t* createHashTable(int64_t nEntries, memory_heap_t *memoryHeap, int64_t heapBlockSize, int placement) {
   hash_table_t *result;
   int64_t nBuckets = nEntries * LOAD_FACTOR;
   
+  // Every thread gets the same number of buckets, so that bucketIndex() can pick one on any thread
+  if (placement == PLACEMENT_MINIMIZER) {
+    nBuckets = ((nBuckets + THREADS - 1) / THREADS) * THREADS;
+  }
+  
   result = malloc(sizeof(hash_table_t));
   
   if (result == NULL) {
@@ -21,6 +91,7 @@ hash_table_t* createHashTable(int64_t nEntries, memory_heap_t *memoryHeap, int64
   }
   
   result->size = nBuckets;
+  result->placement = placement;
   result->table = upc_all_alloc(nBuckets, sizeof(bucket_t));
   
   if (result->table == NULL) {
@@ -41,6 +112,32 @@ hash_table_t* createHashTable(int64_t nEntries, memory_heap_t *memoryHeap, int64
   }
   
   memoryHeap->posInHeap = 0;
+  memoryHeap->heapFill = upc_all_alloc(THREADS, sizeof(int64_t));
+  
+  if (memoryHeap->heapFill == NULL) {
+    fprintf(stderr, "ERROR: Could not allocate memory for the heap fill counters!\n");
+    upc_global_exit(1);
+  }
+  
+  memoryHeap->heapFill[MYTHREAD] = 0;
+  
+  /* Element i of both cyclic arrays lives on thread i%THREADS at local offset i/THREADS,
+     so one private base per castable thread is enough to bypass the runtime for it */
+  result->localTables = malloc(THREADS * sizeof(bucket_t *));
+  memoryHeap->localHeaps = malloc(THREADS * sizeof(kmer_t *));
+  
+  if ((result->localTables == NULL) || (memoryHeap->localHeaps == NULL)) {
+    fprintf(stderr, "ERROR: Could not allocate memory for the local table and heap bases\n");
+    upc_global_exit(1);
+  }
+  
+  for (int t = 0; t < THREADS; ++t) {
+    result->localTables[t] = (t < nBuckets) ? castToLocal(&result->table[t]) : NULL;
+    memoryHeap->localHeaps[t] = castToLocal(&memoryHeap->heap[t]);
+  }
+  
+  // Buckets and fill counters of every thread must be initialized before anybody calls addKmer()
+  upc_barrier;
   
   return result;
 }
@@ -61,19 +158,51 @@ int64_t hashKmer(int64_t  hashtable_size, char *seq) {
   return hashSeq(hashtable_size, seq, KMER_PACKED_LENGTH);
 }
 
+/* Returns the bucket of a kmer given both packed and unpacked. With PLACEMENT_MINIMIZER the
+   minimizer picks the thread and the hash of the k-mer picks one of that thread's buckets */
+int64_t bucketIndex(int64_t tableSize, int placement, char *packedKmer, const unsigned char *kmer) {
+  if (placement == PLACEMENT_MINIMIZER) {
+    return hashKmer(tableSize / THREADS, packedKmer) * THREADS + minimizerOwner(kmer);
+  }
+  return hashKmer(tableSize, packedKmer);
+}
+
+/* Copies the heap entry at index into result, directly if its thread is castable */
+void fetchKmer(memory_heap_t *memoryHeap, int64_t index, kmer_t *result) {
+  kmer_t *localHeap = memoryHeap->localHeaps[index % THREADS];
+  
+  countAccess(index % THREADS, localHeap);
+  if (localHeap != NULL) {
+    *result = localHeap[index / THREADS];
+  }
+  else {
+    upc_memget(result, &memoryHeap->heap[index], sizeof(kmer_t));
+  }
+}
+
+/* Returns the head of a bucket, directly if its thread is castable */
+int64_t bucketHead(hash_table_t *hashtable, int64_t hashval) {
+  bucket_t *localTable = hashtable->localTables[hashval % THREADS];
+  
+  countAccess(hashval % THREADS, localTable);
+  if (localTable != NULL) {
+    return localTable[hashval / THREADS].head;
+  }
+  return hashtable->table[hashval].head;
+}
+
 /* Looks up a kmer in the hash table and returns a pointer to that entry */
 int lookupKmer(hash_table_t *hashtable, memory_heap_t *memoryHeap, kmer_t * result, const unsigned char *kmer) {
   
   char packedKmer[KMER_PACKED_LENGTH];
   packSequence(kmer, (unsigned char*) packedKmer, KMER_LENGTH);
-  int64_t hashval = hashKmer(hashtable->size, (char*) packedKmer);
+  int64_t hashval = bucketIndex(hashtable->size, hashtable->placement, (char*) packedKmer, kmer);
   
-  shared bucket_t * currBucket = &(hashtable->table[hashval]);
-  int64_t currIndex = currBucket->head;
+  int64_t currIndex = bucketHead(hashtable, hashval);
   
   while (currIndex != -1)
   {
-    upc_memget(result, &memoryHeap->heap[currIndex], sizeof(kmer_t));
+    fetchKmer(memoryHeap, currIndex, result);
     if (memcmp(packedKmer, (char *)result->kmer, KMER_PACKED_LENGTH * sizeof(char)) == 0) {   
       return 0;
     }
@@ -89,12 +218,20 @@ int64_t addKmer(hash_table_t *hashtable, memory_heap_t *memoryHeap, const unsign
   /* Pack a k-mer sequence appropriately */
   char packedKmer[KMER_PACKED_LENGTH];
   packSequence(kmer, (unsigned char*) packedKmer, KMER_LENGTH);
-  int64_t hashval = hashKmer(hashtable->size, (char*) packedKmer);
+  int64_t hashval = bucketIndex(hashtable->size, hashtable->placement, (char*) packedKmer, kmer);
   // Convert from "logical thread offset/phase" to global index in cycled array
-  int64_t pos =  memoryHeap->posInHeap * THREADS + MYTHREAD;
+  int64_t pos;
+  if (hashtable->placement == PLACEMENT_MINIMIZER) {
+    // The entry goes to the heap of the thread that owns the bucket, so take a slot there
+    int owner = hashval % THREADS;
+    pos = bupc_atomicI64_fetchadd_relaxed(&memoryHeap->heapFill[owner], 1) * THREADS + owner;
+  }
+  else {
+    pos = memoryHeap->posInHeap * THREADS + MYTHREAD;
+  }
   
-  // Atomically add kmer to bucket
-  int64_t oldHead = hashtable->table[hashval].head;
+  // Atomically add kmer to bucket (the swap itself stays a runtime atomic so that it is coherent with remote ones)
+  int64_t oldHead = bucketHead(hashtable, hashval);
   int64_t realOldHead = bupc_atomicI64_cswap_strict(&hashtable->table[hashval].head, oldHead, pos);
   while (oldHead != realOldHead)
   {
@@ -102,18 +239,26 @@ int64_t addKmer(hash_table_t *hashtable, memory_heap_t *memoryHeap, const unsign
     realOldHead = bupc_atomicI64_cswap_strict(&hashtable->table[hashval].head, oldHead, pos);
   }
   
-  shared kmer_t *indexedKmer = (shared kmer_t *)(&(memoryHeap->heap[pos]));
-  kmer_t tempKmer;
-  
   /* Add the contents to the appropriate kmer struct in the heap */
-  memcpy(tempKmer.kmer, packedKmer, KMER_PACKED_LENGTH * sizeof(char));
-  tempKmer.lExt = leftExt;
-  tempKmer.rExt = rightExt;
-  tempKmer.next = realOldHead;
-  upc_memput(indexedKmer, &tempKmer, sizeof(kmer_t));
+  kmer_t newKmer;
+  memcpy(newKmer.kmer, packedKmer, KMER_PACKED_LENGTH * sizeof(char));
+  newKmer.lExt = leftExt;
+  newKmer.rExt = rightExt;
+  newKmer.next = realOldHead;
+  
+  // Our own part of the heap is always castable, others only with PLACEMENT_MINIMIZER and on our node
+  kmer_t *localHeap = memoryHeap->localHeaps[pos % THREADS];
+  if (localHeap != NULL) {
+    localHeap[pos / THREADS] = newKmer;
+  }
+  else {
+    upc_memput(&memoryHeap->heap[pos], &newKmer, sizeof(kmer_t));
+  }
   
   // Increase the heap pointer
-  memoryHeap->posInHeap++;
+  if (hashtable->placement == PLACEMENT_HASH) {
+    memoryHeap->posInHeap++;
+  }
   
   return pos;
   
@@ -134,15 +279,35 @@ void addKmerToStartList(memory_heap_t *memoryHeap, start_kmer_t **startKmersList
   (*startKmersList) = newEntry;
 }
 
+/* Brings posInHeap up to date with the entries that other threads placed in our part of the heap.
+   Call once construction is over and all threads have passed a barrier */
+void finishHeapPlacement(hash_table_t *hashtable, memory_heap_t *memoryHeap) {
+  if (hashtable->placement == PLACEMENT_MINIMIZER) {
+    memoryHeap->posInHeap = memoryHeap->heapFill[MYTHREAD];
+  }
+}
+
+/* Returns the position of the first start node in startNodes[from..nStartNodes) that is placed on
+   MYTHREAD, or nStartNodes if there is none */
+int64_t nextOwnedStartNode(int64_t *startNodes, int64_t nStartNodes, int64_t from) {
+  while ((from < nStartNodes) && (startNodes[from] % THREADS != MYTHREAD)) {
+    from++;
+  }
+  return from;
+}
+
 /* Deallocate heap. Call before calling deallocHashtable */
 int deallocHeap(memory_heap_t *memoryHeap) {
   upc_all_free(memoryHeap->heap);
+  upc_all_free(memoryHeap->heapFill);
+  free(memoryHeap->localHeaps);
   return 0;
 }
 
 /** Deallocate hashtable */
 int deallocHashtable(hash_table_t *hashtable) {
   upc_all_free(hashtable->table);
+  free(hashtable->localTables);
   free(hashtable);
   return 0;
 }
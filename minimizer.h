@@ -0,0 +1,56 @@
+#ifndef MINIMIZER_H
+#define MINIMIZER_H
+
+#include <stdint.h>
+
+/* Minimizers of k-mers: the smallest (by hash) MINIMIZER_LENGTH-mer of a k-mer. Consecutive
+   k-mers of a contig overlap by KMER_LENGTH-1 bases, so they usually share their minimizer and
+   anything placed by minimizer keeps long runs of a contig together */
+
+#ifndef MINIMIZER_LENGTH
+#define MINIMIZER_LENGTH 15     // At most 32, and at most KMER_LENGTH
+#endif
+
+/* Scrambles a 2-bit encoded m-mer so that minimizers are not biased towards A-rich m-mers */
+uint64_t mixMinimizer(uint64_t code) {
+  code ^= code >> 33;
+  code *= 0xFF51AFD7ED558CCDULL;
+  code ^= code >> 33;
+  code *= 0xC4CEB9FE1A85EC53ULL;
+  code ^= code >> 33;
+  return code;
+}
+
+/* Returns the hash of the minimizer of an unpacked k-mer */
+uint64_t minimizerHash(const unsigned char *kmer) {
+  uint64_t mask = (MINIMIZER_LENGTH < 32) ? ((1ULL << (2 * MINIMIZER_LENGTH)) - 1) : ~0ULL;
+  uint64_t code = 0, best = ~0ULL;
+
+  for (int i = 0; i < KMER_LENGTH; i++) {
+    uint64_t base;
+    switch (kmer[i]) {
+    case 'C':
+      base = 1;
+      break;
+    case 'G':
+      base = 2;
+      break;
+    case 'T':
+      base = 3;
+      break;
+    default:
+      base = 0;
+      break;
+    }
+    code = ((code << 2) | base) & mask;
+    if (i >= MINIMIZER_LENGTH - 1) {
+      uint64_t hashval = mixMinimizer(code);
+      if (hashval < best) {
+        best = hashval;
+      }
+    }
+  }
+  return best;
+}
+
+#endif // MINIMIZER_H
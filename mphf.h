@@ -0,0 +1,167 @@
+#ifndef MPHF_H
+#define MPHF_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+/* BBHash-style minimal perfect hash function over packed k-mers. Level l is a bit array of
+   about MPHF_GAMMA * (keys left) bits; a key goes to the first level where its hash does not
+   collide with any other remaining key. The MPHF value of a key is the rank of its bit over
+   all levels concatenated, so n keys map to exactly 0..n-1 */
+
+#ifndef MPHF_GAMMA
+#define MPHF_GAMMA 1.0
+#endif
+
+#ifndef MPHF_MAX_LEVELS
+#define MPHF_MAX_LEVELS 64
+#endif
+
+/* One rank sample is kept per MPHF_RANK_WORDS 64-bit words */
+#define MPHF_RANK_WORDS 8
+
+/* Minimal perfect hash data structure */
+typedef struct mphf_t mphf_t;
+struct mphf_t {
+  int64_t nKeys;
+  int nLevels;
+  int64_t levelOffset[MPHF_MAX_LEVELS+1];   // First bit of each level, levelOffset[nLevels] is the total
+  uint64_t *bits;                           // All levels concatenated
+  uint64_t *ranks;                          // Number of set bits before every MPHF_RANK_WORDS words
+};
+
+/* Returns the hash value of a packed k-mer for a given level */
+uint64_t mphfHash(const char *packedKmer, int level) {
+  uint64_t hashval = 14695981039346656037ULL ^ ((uint64_t) (level+1) * 0x9E3779B97F4A7C15ULL);
+  for (int i = 0; i < KMER_PACKED_LENGTH; i++) {
+    hashval ^= (unsigned char) packedKmer[i];
+    hashval *= 1099511628211ULL;
+  }
+  /* Final avalanche so that all bits depend on the whole k-mer */
+  hashval ^= hashval >> 33;
+  hashval *= 0xFF51AFD7ED558CCDULL;
+  hashval ^= hashval >> 33;
+  hashval *= 0xC4CEB9FE1A85EC53ULL;
+  hashval ^= hashval >> 33;
+  return hashval;
+}
+
+/* Computes the rank samples of f->bits. Call whenever bits or levelOffset changed */
+int computeMphfRanks(mphf_t *f) {
+  int64_t nWords = f->levelOffset[f->nLevels] / 64;
+  int64_t nSamples = nWords / MPHF_RANK_WORDS + 1;
+  uint64_t count = 0;
+
+  f->ranks = (uint64_t*) malloc(nSamples * sizeof(uint64_t));
+  if (f->ranks == NULL) {
+    return -1;
+  }
+  for (int64_t w = 0; w < nWords; w++) {
+    if (w % MPHF_RANK_WORDS == 0) {
+      f->ranks[w / MPHF_RANK_WORDS] = count;
+    }
+    count += __builtin_popcountll(f->bits[w]);
+  }
+  if (nWords % MPHF_RANK_WORDS == 0) {
+    f->ranks[nWords / MPHF_RANK_WORDS] = count;
+  }
+  return 0;
+}
+
+/* Builds the MPHF over nKeys packed k-mers, the i-th one starting at keys + i*stride.
+   Returns 0 on success and a negative value on failure (out of memory, or duplicated keys) */
+int buildMphf(mphf_t *f, const char *keys, int64_t stride, int64_t nKeys) {
+  int64_t nLeft = nKeys, totalBits = 0;
+  int64_t *left = (int64_t*) malloc((nKeys > 0 ? nKeys : 1) * sizeof(int64_t));
+
+  memset(f, 0, sizeof(mphf_t));
+  f->nKeys = nKeys;
+  if (left == NULL) {
+    return -1;
+  }
+  for (int64_t i = 0; i < nKeys; i++) {
+    left[i] = i;
+  }
+
+  while (nLeft > 0) {
+    if (f->nLevels == MPHF_MAX_LEVELS) {
+      fprintf(stderr, "ERROR: MPHF construction did not converge after %d levels (duplicated k-mers?)\n", MPHF_MAX_LEVELS);
+      free(left);
+      return -2;
+    }
+    int level = f->nLevels;
+    int64_t levelWords = ((int64_t) (MPHF_GAMMA * nLeft) + 63) / 64;
+    int64_t levelBits = levelWords * 64;
+    uint64_t *collide = (uint64_t*) calloc(levelWords, sizeof(uint64_t));
+    uint64_t *bits = (uint64_t*) realloc(f->bits, (totalBits + levelBits) / 64 * sizeof(uint64_t));
+    if (collide == NULL || bits == NULL) {
+      free(collide);
+      free(left);
+      return -1;
+    }
+    f->bits = bits;
+    uint64_t *occupied = f->bits + totalBits / 64;
+    memset(occupied, 0, levelWords * sizeof(uint64_t));
+
+    /* First pass: mark occupied and colliding positions */
+    for (int64_t i = 0; i < nLeft; i++) {
+      uint64_t pos = mphfHash(keys + left[i] * stride, level) % levelBits;
+      uint64_t mask = 1ULL << (pos & 63);
+      if (occupied[pos >> 6] & mask) {
+        collide[pos >> 6] |= mask;
+      }
+      occupied[pos >> 6] |= mask;
+    }
+    /* Only positions hit exactly once are kept in this level */
+    for (int64_t w = 0; w < levelWords; w++) {
+      occupied[w] &= ~collide[w];
+    }
+    /* Second pass: keys that collided go to the next level */
+    int64_t nextLeft = 0;
+    for (int64_t i = 0; i < nLeft; i++) {
+      uint64_t pos = mphfHash(keys + left[i] * stride, level) % levelBits;
+      if (collide[pos >> 6] & (1ULL << (pos & 63))) {
+        left[nextLeft++] = left[i];
+      }
+    }
+    free(collide);
+
+    f->levelOffset[level] = totalBits;
+    totalBits += levelBits;
+    f->levelOffset[level+1] = totalBits;
+    f->nLevels++;
+    nLeft = nextLeft;
+  }
+  free(left);
+
+  return computeMphfRanks(f);
+}
+
+/* Returns the MPHF value (0..nKeys-1) of a packed k-mer. Keys that were not in the build set
+   return either -1 or the value of some other key, so callers must compare the stored k-mer */
+int64_t lookupMphf(const mphf_t *f, const char *packedKmer) {
+  for (int level = 0; level < f->nLevels; level++) {
+    uint64_t levelBits = f->levelOffset[level+1] - f->levelOffset[level];
+    uint64_t bit = f->levelOffset[level] + mphfHash(packedKmer, level) % levelBits;
+    uint64_t word = bit >> 6;
+    if (f->bits[word] & (1ULL << (bit & 63))) {
+      int64_t rank = f->ranks[word / MPHF_RANK_WORDS];
+      for (uint64_t w = word - word % MPHF_RANK_WORDS; w < word; w++) {
+        rank += __builtin_popcountll(f->bits[w]);
+      }
+      return rank + __builtin_popcountll(f->bits[word] & ((1ULL << (bit & 63)) - 1));
+    }
+  }
+  return -1;
+}
+
+/* Deallocate the MPHF */
+int deallocMphf(mphf_t *f) {
+  free(f->bits);
+  free(f->ranks);
+  return 0;
+}
+
+#endif // MPHF_H
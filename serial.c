@@ -7,21 +7,90 @@
 #include "packingDNAseq.h"
 #include "kmerHash.h"
 #include "commonDefaults.h"
+#include "graphSnapshot.h"
+#include "frozenGraph.h"
+#include "bgzfUFX.h"
+#include "externalAssembly.h"
 
 int main(int argc, char **argv) {
 
   time_t start, end;
   double constrTime, traversalTime;
-  char cur_contig[MAXIMUM_CONTIG_SIZE], unpackedKmer[KMER_LENGTH+1], left_ext, right_ext, *inputUFXName;
+  char cur_contig[MAXIMUM_CONTIG_SIZE], unpackedKmer[KMER_LENGTH+1], left_ext, right_ext, *inputUFXName = NULL;
+  char *saveSnapshotName = NULL, *loadSnapshotName = NULL, *scratchDir = "output";
+  int freeze = 0, nPartitions = 0;
   int64_t posInContig, contigID = 0, totBases = 0, ptr = 0, nKmers, cur_chars_read, total_chars_to_read;
   unpackedKmer[KMER_LENGTH] = '\0';
   kmer_t *cur_kmer_ptr;
+  frozen_kmer_t *cur_frozen_ptr;
   start_kmer_t *startKmersList = NULL, *curStartNode;
   unsigned char *working_buffer;
   FILE *inputFile, *serialOutputFile;
   
-  /* Read the input file name */
-  inputUFXName = argv[1];
+  /* Read the input file name, the optional snapshot to save to (-s) or load from (-l), whether to freeze the graph (-f)
+     and the number of on-disk partitions (-x) and their directory (-t) for the external-memory mode.
+     A loaded snapshot replaces the input, so the input file name is only needed without -l */
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+      saveSnapshotName = argv[++i];
+    } else if (strcmp(argv[i], "-l") == 0 && i + 1 < argc) {
+      loadSnapshotName = argv[++i];
+    } else if (strcmp(argv[i], "-f") == 0) {
+      freeze = 1;
+    } else if (strcmp(argv[i], "-x") == 0 && i + 1 < argc) {
+      nPartitions = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+      scratchDir = argv[++i];
+    } else if (inputUFXName == NULL) {
+      inputUFXName = argv[i];
+    }
+  }
+  if (inputUFXName == NULL && loadSnapshotName == NULL) {
+    fprintf(stderr, "Usage: %s (<input UFX> | -l <snapshot to load>) [-s <snapshot to save>] [-f] [-x <partitions> [-t <scratch dir>]]\n", argv[0]);
+    return 1;
+  }
+  /* The external-memory mode never holds the whole graph, so there is nothing to snapshot or freeze */
+  if (nPartitions > 0 && (saveSnapshotName != NULL || loadSnapshotName != NULL || freeze)) {
+    fprintf(stderr, "%s: -x cannot be combined with -s, -l or -f\n", argv[0]);
+    return 1;
+  }
+  
+  if (nPartitions > 0) {
+    /* ============== EXTERNAL-MEMORY ASSEMBLY ============== */
+    
+    start = clock();
+    initLookupTable();
+    
+    /* Scatter the k-mers to disk, then build and walk one partition at a time */
+    int64_t nMiddleSegments = 0, partitionSegments;
+    if (scatterUFX(inputUFXName, scratchDir, nPartitions) < 0) {
+      return 1;
+    }
+    for (int p = 0; p < nPartitions; p++) {
+      if ((partitionSegments = assemblePartition(scratchDir, p, nPartitions)) < 0) {
+        return 1;
+      }
+      nMiddleSegments += partitionSegments;
+    }
+    
+    end = clock();
+    constrTime = 1.0 * (end-start) / CLOCKS_PER_SEC;
+    
+    /* Resolve the segments that cross partitions into whole contigs */
+    start = clock();
+    serialOutputFile = fopen("output/serial.out", "w");
+    contigID = stitchSegments(scratchDir, nPartitions, nMiddleSegments, serialOutputFile, &totBases);
+    fclose(serialOutputFile);
+    if (contigID < 0) {
+      return 1;
+    }
+    end = clock();
+    
+    printf("Generated %lld contigs with %lld total bases\n", contigID, totBases);
+    traversalTime = 1.0 * (end-start) / CLOCKS_PER_SEC;
+    printf("Total execution time: %f seconds (%f partitioned construction / %f segment stitching)\n", constrTime+traversalTime, constrTime, traversalTime );
+    return 0;
+  }
   
   /* ============== GRAPH CONSTRUCTION ============== */
   
@@ -29,42 +98,123 @@ int main(int argc, char **argv) {
   /* Initialize lookup table that will be used for the DNA packing routines */
   initLookupTable();
   
-  /* Extract the number of k-mers in the input file */
-  nKmers = getNumKmersInUFX(inputUFXName);
   hash_table_t *hashtable;
   memory_heap_t memory_heap;
+  graph_snapshot_t snapshot = { NULL, 0 };
+  frozen_graph_t frozen;
   
-  /* Create a hash table */
-  hashtable = createHashTable(nKmers, &memory_heap);
-  
-  /* Read the kmers from the input file and store them in the working_buffer */
-  total_chars_to_read = nKmers * LINE_SIZE;
-  working_buffer = (unsigned char*) malloc(total_chars_to_read * sizeof(unsigned char));
-  inputFile = fopen(inputUFXName, "r");
-  cur_chars_read = fread(working_buffer, sizeof(unsigned char),total_chars_to_read , inputFile);
-  fclose(inputFile);
-  
-  /* Process the working_buffer and store the k-mers in the hash table */
-  /* Expected format: KMER LR ,i.e. first k characters that represent the kmer, then a tab and then two chatacers, one for the left (backward) extension and one for the right (forward) extension */
-  
-  while (ptr < cur_chars_read) {
-    /* working_buffer[ptr] is the start of the current k-mer                */
-    /* so current left extension is at working_buffer[ptr+KMER_LENGTH+1]    */
-    /* and current right extension is at working_buffer[ptr+KMER_LENGTH+2]  */
-    
-    left_ext = (char) working_buffer[ptr+KMER_LENGTH+1];
-    right_ext = (char) working_buffer[ptr+KMER_LENGTH+2];
+  if (loadSnapshotName != NULL) {
+    /* Map a previously built graph and go straight to the traversal */
+    hashtable = loadGraphSnapshot(loadSnapshotName, &memory_heap, &startKmersList, &snapshot);
+    if (hashtable == NULL) {
+      return 1;
+    }
+  } else {
+    /* Extract the number of k-mers in the input file, which may be BGZF block-compressed.
+       It is unknown for streams, which are read STREAM_CHUNK_LINES at a time while the table grows */
+    int streamInput = isUFXStream(inputUFXName);
+    int compressedInput = !streamInput && isBgzfFile(inputUFXName);
+    bgzf_index_t bgzfIndex;
+    if (streamInput) {
+      nKmers = 0;
+    } else if (compressedInput) {
+      nKmers = getNumKmersInBgzfUFX(inputUFXName, &bgzfIndex);
+    } else {
+      nKmers = getNumKmersInUFX(inputUFXName);
+    }
+    if (nKmers < 0) {
+      return 1;
+    }
     
-    /* Add k-mer to hash table */
-    addKmer(hashtable, &memory_heap, &working_buffer[ptr], left_ext, right_ext);
+    /* Create a hash table */
+    hashtable = createHashTable(nKmers, &memory_heap);
     
-    /* Create also a list with the "start" kmers: nodes with F as left (backward) extension */
-    if (left_ext == 'F') {
-      addKmerToStartList(&memory_heap, &startKmersList);
+    /* Read the kmers from the input file and store them in the working_buffer */
+    total_chars_to_read = (streamInput ? STREAM_CHUNK_LINES : nKmers) * LINE_SIZE;
+    working_buffer = (unsigned char*) malloc((total_chars_to_read > 0 ? total_chars_to_read : 1) * sizeof(unsigned char));
+    if (working_buffer == NULL) {
+      fprintf(stderr, "Could not allocate %lld bytes for the working_buffer\n", total_chars_to_read);
+      return 1;
+    }
+    if (streamInput) {
+      inputFile = (strcmp(inputUFXName, "-") == 0) ? stdin : fopen(inputUFXName, "r");
+      if (inputFile == NULL) {
+        fprintf(stderr, "Could not open %s for reading!\n", inputUFXName);
+        return 1;
+      }
+      cur_chars_read = 0;
+    } else if (compressedInput) {
+      cur_chars_read = readBgzfRange(inputUFXName, &bgzfIndex, 0, total_chars_to_read, working_buffer);
+      deallocBgzfIndex(&bgzfIndex);
+    } else {
+      inputFile = fopen(inputUFXName, "r");
+      if (inputFile == NULL) {
+        fprintf(stderr, "Could not open %s for reading!\n", inputUFXName);
+        return 1;
+      }
+      cur_chars_read = fread(working_buffer, sizeof(unsigned char),total_chars_to_read , inputFile);
+      fclose(inputFile);
+    }
+    if (!streamInput && cur_chars_read != total_chars_to_read) {
+      fprintf(stderr, "Only read %lld/%lld bytes of %s\n", cur_chars_read, total_chars_to_read, inputUFXName);
+      return 1;
     }
     
-    /* Move to the next k-mer in the input working_buffer */
-    ptr += LINE_SIZE;
+    /* Process the working_buffer and store the k-mers in the hash table */
+    /* Expected format: KMER LR ,i.e. first k characters that represent the kmer, then a tab and then two chatacers, one for the left (backward) extension and one for the right (forward) extension */
+    
+    do {
+      if (streamInput) {
+        /* Refill the working_buffer with the next chunk of the stream */
+        cur_chars_read = fread(working_buffer, sizeof(unsigned char), total_chars_to_read, inputFile);
+        ptr = 0;
+        if (cur_chars_read % LINE_SIZE != 0 || (cur_chars_read > 0 && working_buffer[KMER_LENGTH] != ' ' && working_buffer[KMER_LENGTH] != '\t')) {
+          fprintf(stderr, "UFX stream %s is not made of %d byte lines for kmer length %d\n", inputUFXName, LINE_SIZE, KMER_LENGTH);
+          return 1;
+        }
+      }
+      
+      while (ptr < cur_chars_read) {
+        /* working_buffer[ptr] is the start of the current k-mer                */
+        /* so current left extension is at working_buffer[ptr+KMER_LENGTH+1]    */
+        /* and current right extension is at working_buffer[ptr+KMER_LENGTH+2]  */
+      
+        left_ext = (char) working_buffer[ptr+KMER_LENGTH+1];
+        right_ext = (char) working_buffer[ptr+KMER_LENGTH+2];
+      
+        /* Add k-mer to hash table */
+        addKmer(hashtable, &memory_heap, &working_buffer[ptr], left_ext, right_ext);
+      
+        /* Create also a list with the "start" kmers: nodes with F as left (backward) extension */
+        if (left_ext == 'F') {
+          addKmerToStartList(&memory_heap, &startKmersList);
+        }
+      
+        /* Move to the next k-mer in the input working_buffer */
+        ptr += LINE_SIZE;
+      }
+    } while (streamInput && cur_chars_read > 0);
+    
+    if (streamInput) {
+      printf("Read %lld kmers from UFX stream: %s\n", memory_heap.posInHeap, inputUFXName);
+      if (inputFile != stdin) {
+        fclose(inputFile);
+      }
+    }
+    free(working_buffer);
+  }
+  
+  /* A loaded graph can be written out again, e.g. to move a snapshot to another file system */
+  if (saveSnapshotName != NULL && writeGraphSnapshot(saveSnapshotName, hashtable, &memory_heap, startKmersList) != 0) {
+    return 1;
+  }
+  
+  /* The graph is read-only from now on: optionally replace the hash table by the frozen graph */
+  if (freeze) {
+    if (freezeGraph(&frozen, &memory_heap, startKmersList) != 0) {
+      return 1;
+    }
+    deallocGraph(hashtable, &memory_heap, &snapshot);
   }
   
   end = clock();
@@ -80,20 +230,31 @@ int main(int argc, char **argv) {
   
   while (curStartNode != NULL ) {
     /* Need to unpack the seed first */
-    cur_kmer_ptr = curStartNode->kmerPtr;
-    unpackSequence((unsigned char*) cur_kmer_ptr->kmer,  (unsigned char*) unpackedKmer, KMER_LENGTH);
+    if (freeze) {
+      cur_frozen_ptr = &(frozen.kmers[curStartNode->kmerIndex]);
+      unpackSequence((unsigned char*) cur_frozen_ptr->kmer,  (unsigned char*) unpackedKmer, KMER_LENGTH);
+      right_ext = cur_frozen_ptr->r_ext;
+    } else {
+      cur_kmer_ptr = heapKmer(&memory_heap, curStartNode->kmerIndex);
+      unpackSequence((unsigned char*) cur_kmer_ptr->kmer,  (unsigned char*) unpackedKmer, KMER_LENGTH);
+      right_ext = cur_kmer_ptr->r_ext;
+    }
     /* Initialize current contig with the seed content */
     memcpy(cur_contig, unpackedKmer, KMER_LENGTH * sizeof(char));
     posInContig = KMER_LENGTH;
-    right_ext = cur_kmer_ptr->r_ext;
     
     /* Keep adding bases while not finding a terminal node */
     while (right_ext != 'F') {
       cur_contig[posInContig] = right_ext;
       posInContig++;
       /* At position cur_contig[posInContig-KMER_LENGTH] starts the last k-mer in the current contig */
-      cur_kmer_ptr = lookupKmer(hashtable, (const unsigned char *) &cur_contig[posInContig-KMER_LENGTH]);
-      right_ext = cur_kmer_ptr->r_ext;
+      if (freeze) {
+        cur_frozen_ptr = lookupFrozenKmer(&frozen, (const unsigned char *) &cur_contig[posInContig-KMER_LENGTH]);
+        right_ext = cur_frozen_ptr->r_ext;
+      } else {
+        cur_kmer_ptr = lookupKmer(hashtable, &memory_heap, (const unsigned char *) &cur_contig[posInContig-KMER_LENGTH]);
+        right_ext = cur_kmer_ptr->r_ext;
+      }
     }
     
     /* Print the contig since we have found the corresponding terminal node */
@@ -109,8 +270,11 @@ int main(int argc, char **argv) {
   
   // Clean up
   fclose(serialOutputFile);
-  deallocHeap(&memory_heap);
-  deallocHashtable(hashtable);
+  if (freeze) {
+    deallocFrozenGraph(&frozen);
+  } else {
+    deallocGraph(hashtable, &memory_heap, &snapshot);
+  }
   
   /* Print timing and output info */
   printf("Generated %lld contigs with %lld total bases\n", contigID, totBases);